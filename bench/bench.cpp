@@ -0,0 +1,221 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	bench.cpp
+*
+* @brief:	microbenchmarks of the data path: decode, publish, JSON and LoRa payload
+* @author:	Dierk Arp
+* @date:	20261016 16:40:07
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+//
+// native build only: pio run -e native && .pio/build/native/program [iterations]
+// reports time and heap allocations per operation of each stage
+//
+#include <chrono>
+#include <malloc.h>
+#include <ArduinoJson.h>
+#include "globals.h"
+#include "payload.h"
+#include "meterjson.h"
+
+#define BENCH_METER_ADDR    (1)
+#define BENCH_ITERATIONS    (200000)
+
+RemoteDebug Debug;
+
+//
+// heap allocations: malloc() is wrapped, glibc only
+//
+static unsigned long ulAllocs = 0;
+
+#ifdef __GLIBC__
+extern "C" void *__libc_malloc(size_t uSize);
+extern "C" void *__libc_calloc(size_t uN, size_t uSize);
+extern "C" void *__libc_realloc(void *p, size_t uSize);
+
+extern "C" void *malloc(size_t uSize)
+{
+    ulAllocs++;
+    return __libc_malloc(uSize);
+}
+
+extern "C" void *calloc(size_t uN, size_t uSize)
+{
+    ulAllocs++;
+    return __libc_calloc(uN, uSize);
+}
+
+extern "C" void *realloc(void *p, size_t uSize)
+{
+    ulAllocs++;
+    return __libc_realloc(p, uSize);
+}
+#define BENCH_ALLOCS        (true)
+#else
+#define BENCH_ALLOCS        (false)
+#endif
+
+typedef void (*bench_fn_t)(void);
+
+static ModBusMeter *pMeter;
+static const mb_metermap_t *pMap;
+static ModbusMessage aResponse[MB_MAX_BLOCKS];
+static uint8_t abRegs[2*MB_MAX_BLOCK_WORDS];
+static uint8_t abPayload[32];
+static char szJson[2048];
+static volatile uint32_t ulSink;
+
+/**
+ * @brief run a stage, print ns/op and allocations/op
+ * 
+ * @param pszName   name of stage
+ * @param pfn       one operation
+ * @param ulIter    # of operations
+ */
+static void Bench(const char *pszName, bench_fn_t pfn, uint32_t ulIter)
+{
+    for (uint32_t i=0; i<ulIter/10; i++)     // warm up caches and allocator
+        pfn();
+
+    unsigned long ulA = ulAllocs;
+    auto tStart = std::chrono::steady_clock::now();
+    for (uint32_t i=0; i<ulIter; i++)
+        pfn();
+    auto tEnd = std::chrono::steady_clock::now();
+    ulA = ulAllocs - ulA;
+
+    double dNs = std::chrono::duration<double, std::nano>(tEnd - tStart).count() / ulIter;
+    if (BENCH_ALLOCS)
+        printf("%-24s %10.1f ns/op %8.2f allocs/op\n", pszName, dNs, (double)ulA / ulIter);
+    else
+        printf("%-24s %10.1f ns/op %8s allocs/op\n", pszName, dNs, "-");
+}
+
+/**
+ * @brief response of a block read as the meter sends it: every float register 230.0, every int register 1000
+ */
+static void BuildResponse(int iBlock)
+{
+    const mb_block_t *pB = &pMap->pBlocks[iBlock];
+    uint8_t abData[2*MB_MAX_BLOCK_WORDS] = { 0 };
+
+    const mb_regdesc_t *pR = &pMap->pRegs[pB->uFirstReg];
+    for (int i=0; i<pB->uNRegs; i++, pR++)
+    {
+        uint8_t *p = &abData[2*(pR->uAddr - pB->uStart)];
+        if (pR->eType == DT_FLOAT)
+        {
+            float fValue = 230.0;
+            uint32_t ulRaw;
+            memcpy(&ulRaw, &fValue, sizeof(ulRaw));
+            p[0] = ulRaw >> 24; p[1] = ulRaw >> 16; p[2] = ulRaw >> 8; p[3] = ulRaw;
+        }
+        else
+        {
+            p[pR->uWords*2 - 2] = 1000 >> 8;
+            p[pR->uWords*2 - 1] = 1000 & 0xff;
+        }
+    }
+
+    ModbusMessage &m = aResponse[iBlock];
+    m.add((uint8_t)BENCH_METER_ADDR);
+    m.add(pB->uFC);
+    m.add((uint8_t)(2*pB->uWords));
+    m.add(abData, 2*pB->uWords);
+}
+
+// decode of the first block, without publication
+static void BenchDecode(void)
+{
+    mb_reqctx_t ctx = { 0 };
+    ctx.uBlock = 0;
+    ctx.ulCycle = pMeter->GetCycles() - 1;
+    pMeter->handleMeterData(aResponse[0].data(), aResponse[0].size(), ctx);
+}
+
+// decode of all blocks of a read cycle and publication
+static void BenchCycle(void)
+{
+    mb_reqctx_t ctx = { 0 };
+    for (int i=0; i<pMap->uNBlocks; i++)
+    {
+        ctx.uBlock = i;
+        ctx.ulCycle = pMeter->GetCycles();
+        pMeter->handleMeterData(aResponse[i].data(), aResponse[i].size(), ctx);
+    }
+}
+
+static void BenchSnapshot(void)
+{
+    mb_snapshot_t snap;
+    pMeter->GetSnapshot(snap);
+    ulSink = snap.ulCycle;
+}
+
+static void BenchShadow(void)
+{
+    const mb_block_t *pB = &pMap->pBlocks[0];
+    ulSink = pMeter->ReadShadow(pB->uFC, pB->uStart, pB->uWords, abRegs);
+}
+
+static void BenchJson(void)
+{
+    DynamicJsonDocument doc(MJ_JSON_SIZE);
+    MeterToJson(pMeter, doc.to<JsonObject>());
+    ulSink = serializeJson(doc, szJson, sizeof(szJson));
+}
+
+static void BenchPayload(void)
+{
+    ulSink = PackMeterPayload(pMeter, abPayload, sizeof(abPayload));
+}
+
+#ifndef PIO_UNIT_TESTING          // the unit tests under test/ bring their own main
+int main(int argc, char *argv[])
+{
+    uint32_t ulIter = (argc > 1) ? strtoul(argv[1], NULL, 0) : BENCH_ITERATIONS;
+    eMeterType mt = MT_SDM630;
+    uint16_t uAddr = BENCH_METER_ADDR;
+
+    StartModBus(9600, 1, &mt, &uAddr);
+    pMeter = GetMeterDataPtr(0);
+    pMap = GetMeterMap(mt);
+    for (int i=0; i<pMap->uNBlocks; i++)
+        BuildResponse(i);
+    BenchCycle();           // publish once, shadow image valid
+
+    printf("%s at address %d: %d registers in %d blocks, %d iterations\n",
+        pMap->pszName, uAddr, pMap->uNRegs, pMap->uNBlocks, ulIter);
+    Bench("decode block", BenchDecode, ulIter);
+    Bench("decode cycle + publish", BenchCycle, ulIter);
+    Bench("snapshot", BenchSnapshot, ulIter);
+    Bench("shadow read", BenchShadow, ulIter);
+    Bench("json /api/meter", BenchJson, ulIter);
+    Bench("lora payload", BenchPayload, ulIter);
+    return 0;
+}
+#endif
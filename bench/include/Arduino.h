@@ -0,0 +1,103 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	Arduino.h
+*
+* @brief:	minimal Arduino core for the native build of the data path
+* @author:	Dierk Arp
+* @date:	20261016 16:40:07
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+#ifndef _NATIVE_ARDUINO_H_INCLUDED
+#define _NATIVE_ARDUINO_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <math.h>
+#include <assert.h>
+#include <string>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+typedef bool boolean;
+
+#define F(s)                (s)
+#define constrain(v, lo, hi) ((v) < (lo) ? (lo) : ((v) > (hi) ? (hi) : (v)))
+
+#define OUTPUT              (0x03)
+#define SERIAL_8N1          (0x800001c)
+
+/// String subset used by the data path
+class String : public std::string
+{
+public:
+    String() {}
+    String(const char *psz) : std::string(psz ? psz : "") {}
+    String(const std::string &s) : std::string(s) {}
+
+    void trim();
+    bool equalsIgnoreCase(const char *psz) const     { return strncasecmp(c_str(), psz, size()) == 0 && size() == strlen(psz); }
+    String substring(unsigned int uFrom) const       { return (uFrom < size()) ? String(substr(uFrom)) : String(); }
+    String substring(unsigned int uFrom, unsigned int uTo) const;
+    long toInt() const                               { return atol(c_str()); }
+};
+
+class HardwareSerial
+{
+public:
+    void begin(unsigned long ulBaud, uint32_t ulConfig, int8_t iRx, int8_t iTx) {}
+};
+extern HardwareSerial Serial2;
+
+extern unsigned long millis(void);
+extern unsigned long micros(void);
+extern void delay(uint32_t ulMs);
+extern void pinMode(uint8_t uPin, uint8_t uMode);
+extern uint32_t esp_random(void);
+
+//
+// FreeRTOS: single threaded, a take never blocks
+//
+typedef void *SemaphoreHandle_t;
+typedef uint32_t TickType_t;
+#define pdTRUE              (1)
+#define pdFALSE             (0)
+#define portMAX_DELAY       (0xffffffffUL)
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+
+extern SemaphoreHandle_t xSemaphoreCreateMutex(void);
+extern SemaphoreHandle_t xSemaphoreCreateCounting(uint32_t uMax, uint32_t uInit);
+extern int xSemaphoreTake(SemaphoreHandle_t h, TickType_t ulWait);
+extern int xSemaphoreGive(SemaphoreHandle_t h);
+extern int xQueueReset(SemaphoreHandle_t h);
+
+#endif
@@ -0,0 +1,131 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	ModbusClientRTU.h
+*
+* @brief:	eModbus client for the native build: keeps requests, no serial line
+* @author:	Dierk Arp
+* @date:	20261016 16:40:07
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+#ifndef _NATIVE_MODBUSCLIENTRTU_H_INCLUDED
+#define _NATIVE_MODBUSCLIENTRTU_H_INCLUDED
+
+#include <vector>
+#include "Arduino.h"
+#include "ModbusTypeDefs.h"
+
+/// response as eModbus delivers it: vector of server id, function code and data, no CRC
+class ModbusMessage
+{
+public:
+    ModbusMessage() {}
+    explicit ModbusMessage(uint16_t uReserve)   { MM_data.reserve(uReserve); }
+
+    const uint8_t *data() const                 { return MM_data.data(); }
+    uint16_t size() const                       { return MM_data.size(); }
+    uint8_t operator[](uint16_t uIdx) const     { return (uIdx < MM_data.size()) ? MM_data[uIdx] : 0; }
+    uint8_t getServerID() const                 { return (MM_data.size() > 0) ? MM_data[0] : 0; }
+    uint8_t getFunctionCode() const             { return (MM_data.size() > 1) ? (MM_data[1] & 0x7f) : 0; }
+    Error getError() const                      { return ((MM_data.size() > 2) && (MM_data[1] & 0x80)) ? (Error)MM_data[2] : SUCCESS; }
+    std::vector<uint8_t>::const_iterator begin() const { return MM_data.begin(); }
+    std::vector<uint8_t>::const_iterator end() const   { return MM_data.end(); }
+    void clear()                                { MM_data.clear(); }
+
+    uint16_t add(uint8_t uByte)                 { MM_data.push_back(uByte); return MM_data.size(); }
+    uint16_t add(uint16_t uWord)                { add((uint8_t)(uWord >> 8)); return add((uint8_t)(uWord & 0xff)); }
+    uint16_t add(const uint8_t *pData, uint16_t uLen) { MM_data.insert(MM_data.end(), pData, pData + uLen); return MM_data.size(); }
+
+protected:
+    std::vector<uint8_t> MM_data;
+};
+
+/// error code with readable text
+class ModbusError
+{
+public:
+    ModbusError(Error e) : err(e) {}
+    operator Error() const                      { return err; }
+    operator const char *() const               { return (err == SUCCESS) ? "Success" : ((err < TIMEOUT) ? "Exception" : "Transport error"); }
+
+private:
+    Error err;
+};
+
+typedef void (*MBOnData)(ModbusMessage msg, uint32_t token);
+typedef void (*MBOnError)(Error error, uint32_t token);
+
+/// request handed to the client
+typedef struct
+{
+    uint32_t token;
+    uint8_t uServer;
+    uint8_t uFC;
+    uint16_t uAddr;
+    uint16_t uWords;
+} native_request_t;
+
+/// client without a serial line: requests are kept until the caller answers them with onData/onError
+class ModbusClientRTU
+{
+public:
+    ModbusClientRTU(HardwareSerial &serial, int8_t iRtsPin = -1) : pfnData(nullptr), pfnError(nullptr), ulTimeout(2000) {}
+
+    void begin(int iCoreID = -1)                { }
+    void setTimeout(uint32_t ulTO)              { ulTimeout = ulTO; }
+    void onDataHandler(MBOnData pfn)            { pfnData = pfn; }
+    void onErrorHandler(MBOnError pfn)          { pfnError = pfn; }
+    Error addRequest(uint32_t token, uint8_t uServer, uint8_t uFC, uint16_t uAddr, uint16_t uWords)
+    {
+        aRequests.push_back({ token, uServer, uFC, uAddr, uWords });
+        return SUCCESS;
+    }
+    Error addRequest(uint32_t token, uint8_t uServer, uint8_t uFC, uint16_t uAddr, uint16_t uWords, uint8_t uBytes, uint16_t *pValues)
+    {
+        aRequests.push_back({ token, uServer, uFC, uAddr, uWords });
+        aWritten.assign(pValues, pValues + uWords);
+        return SUCCESS;
+    }
+    Error addRequest(ModbusMessage msg, uint32_t token)
+    {
+        if (msg.size() < 6)
+            return PARAMETER_COUNT_ERROR;
+        return addRequest(token, msg[0], msg[1], (msg[2] << 8) | msg[3], (msg[4] << 8) | msg[5]);
+    }
+
+    std::vector<native_request_t> aRequests;    // not yet answered
+    std::vector<uint16_t> aWritten;             // values of last FC16 request
+    MBOnData pfnData;
+    MBOnError pfnError;
+    uint32_t ulTimeout;
+};
+
+namespace RTUutils
+{
+    uint16_t calcCRC(const uint8_t *pData, uint16_t uLen);
+}
+
+#endif
@@ -0,0 +1,84 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	ModbusTypeDefs.h
+*
+* @brief:	eModbus error and function codes for the native build
+* @author:	Dierk Arp
+* @date:	20261016 16:40:07
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+#ifndef _NATIVE_MODBUSTYPEDEFS_H_INCLUDED
+#define _NATIVE_MODBUSTYPEDEFS_H_INCLUDED
+
+#include <stdint.h>
+
+enum FunctionCode : uint8_t
+{
+    ANY_FUNCTION_CODE       = 0x00,
+    READ_COIL               = 0x01,
+    READ_DISCR_INPUT        = 0x02,
+    READ_HOLD_REGISTER      = 0x03,
+    READ_INPUT_REGISTER     = 0x04,
+    WRITE_COIL              = 0x05,
+    WRITE_HOLD_REGISTER     = 0x06,
+    WRITE_MULT_REGISTERS    = 0x10
+};
+
+enum Error : uint8_t
+{
+    SUCCESS                 = 0x00,
+    ILLEGAL_FUNCTION        = 0x01,
+    ILLEGAL_DATA_ADDRESS    = 0x02,
+    ILLEGAL_DATA_VALUE      = 0x03,
+    SERVER_DEVICE_FAILURE   = 0x04,
+    ACKNOWLEDGE             = 0x05,
+    SERVER_DEVICE_BUSY      = 0x06,
+    NEGATIVE_ACKNOWLEDGE    = 0x07,
+    MEMORY_PARITY_ERROR     = 0x08,
+    GATEWAY_PATH_UNAVAIL    = 0x0A,
+    GATEWAY_TARGET_NO_RESP  = 0x0B,
+    TIMEOUT                 = 0xE0,
+    INVALID_SERVER          = 0xE1,
+    CRC_ERROR               = 0xE2,
+    FC_MISMATCH             = 0xE3,
+    SERVER_ID_MISMATCH      = 0xE4,
+    PACKET_LENGTH_ERROR     = 0xE5,
+    PARAMETER_COUNT_ERROR   = 0xE6,
+    PARAMETER_LIMIT_ERROR   = 0xE7,
+    REQUEST_QUEUE_FULL      = 0xE8,
+    ILLEGAL_IP_OR_PORT      = 0xE9,
+    IP_CONNECTION_FAILED    = 0xEA,
+    TCP_HEAD_MISMATCH       = 0xEB,
+    EMPTY_MESSAGE           = 0xEC,
+    ASCII_FRAME_ERR         = 0xED,
+    ASCII_CRC_ERR           = 0xEE,
+    ASCII_INVALID_CHAR      = 0xEF,
+    BROADCAST_ERROR         = 0xF0,
+    UNDEFINED_ERROR         = 0xFF
+};
+
+#endif
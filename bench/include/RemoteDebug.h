@@ -0,0 +1,48 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	RemoteDebug.h
+*
+* @brief:	debug macros of RemoteDebug for the native build
+* @author:	Dierk Arp
+* @date:	20261016 16:40:07
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+#ifndef _NATIVE_REMOTEDEBUG_H_INCLUDED
+#define _NATIVE_REMOTEDEBUG_H_INCLUDED
+
+// logging is compiled out: the benchmark measures the data path, not printf
+#define debugV(...)         do {} while (0)
+#define debugD(...)         do {} while (0)
+#define debugI(...)         do {} while (0)
+#define debugW(...)         do {} while (0)
+#define debugE(...)         do {} while (0)
+
+class RemoteDebug
+{
+};
+
+#endif
@@ -0,0 +1,146 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	native.cpp
+*
+* @brief:	Arduino, FreeRTOS and eModbus support of the native build
+* @author:	Dierk Arp
+* @date:	20261016 16:40:07
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+#include <chrono>
+#include <random>
+#include "Arduino.h"
+#include "ModbusClientRTU.h"
+#include "esp_timer.h"
+
+HardwareSerial Serial2;
+
+static const std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+static std::minstd_rand Random;
+
+/// counting semaphore without waiting: the native build is single threaded
+typedef struct
+{
+    uint32_t uCount;
+    uint32_t uMax;
+} native_sem_t;
+
+
+void String::trim()
+{
+    size_t uFirst = find_first_not_of(" \t\r\n");
+    if (uFirst == npos)
+    {
+        clear();
+        return;
+    }
+    size_t uLast = find_last_not_of(" \t\r\n");
+    assign(substr(uFirst, uLast - uFirst + 1));
+}
+
+String String::substring(unsigned int uFrom, unsigned int uTo) const
+{
+    if (uFrom > uTo)
+        std::swap(uFrom, uTo);
+    if (uFrom >= size())
+        return String();
+    return String(substr(uFrom, uTo - uFrom));
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tStart).count();
+}
+
+unsigned long millis(void)
+{
+    return (unsigned long)(esp_timer_get_time() / 1000);
+}
+
+unsigned long micros(void)
+{
+    return (unsigned long)esp_timer_get_time();
+}
+
+void delay(uint32_t ulMs)
+{
+}
+
+void pinMode(uint8_t uPin, uint8_t uMode)
+{
+}
+
+uint32_t esp_random(void)
+{
+    return Random();
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return new native_sem_t { 1, 1 };
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(uint32_t uMax, uint32_t uInit)
+{
+    return new native_sem_t { uInit, uMax };
+}
+
+int xSemaphoreTake(SemaphoreHandle_t h, TickType_t ulWait)
+{
+    native_sem_t *pS = (native_sem_t *)h;
+    if (pS->uCount == 0)
+        return pdFALSE;
+    pS->uCount--;
+    return pdTRUE;
+}
+
+int xSemaphoreGive(SemaphoreHandle_t h)
+{
+    native_sem_t *pS = (native_sem_t *)h;
+    if (pS->uCount >= pS->uMax)
+        return pdFALSE;
+    pS->uCount++;
+    return pdTRUE;
+}
+
+int xQueueReset(SemaphoreHandle_t h)
+{
+    ((native_sem_t *)h)->uCount = 0;
+    return pdTRUE;
+}
+
+uint16_t RTUutils::calcCRC(const uint8_t *pData, uint16_t uLen)
+{
+    uint16_t uCrc = 0xffff;
+    while (uLen--)
+    {
+        uCrc ^= *pData++;
+        for (int i=0; i<8; i++)
+            uCrc = (uCrc & 1) ? (uCrc >> 1) ^ 0xa001 : (uCrc >> 1);
+    }
+    return uCrc;
+}
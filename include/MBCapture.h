@@ -0,0 +1,114 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	MBCapture.h
+*
+* @brief:	ring buffer of raw Modbus RTU frames, exported as pcap
+* @author:	Dierk Arp
+* @date:	20261016 16:40:07
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+#ifndef _MBCAPTURE_H_INCLUDED
+#define _MBCAPTURE_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ModbusClientRTU.h"
+
+/// capture mode
+enum eCapMode
+{
+      CM_OFF,               // no capture, no buffer
+      CM_ALWAYS,            // keep the latest frames
+      CM_ERROR              // stop MBC_POST_RECORDS after the first error: frames before and after it are kept
+};
+
+/// type of captured record, first byte of pseudo header in pcap
+enum eCapType
+{
+      CR_REQUEST,           // request frame
+      CR_RESPONSE,          // data or exception response frame
+      CR_ERROR              // no valid response, frame: server id, function code
+};
+
+#define MBC_SIZE             (8192)     // ring buffer [bytes]
+#define MBC_POST_RECORDS     (16)       // records after trigger in CM_ERROR
+#define MBC_MAX_FRAME        (256)      // max. RTU frame size
+#define MBC_LINKTYPE         (147)      // pcap link type LINKTYPE_USER0
+#define MBC_PSEUDO_HDR       (2)        // pcap pseudo header: eCapType, error code
+
+/**
+ * @brief capture of Modbus RTU frames with microsecond timestamps
+ *        frames are rebuilt from the eModbus requests and responses incl. CRC, 
+ *        stored binary without formatting.
+ *        not thread safe: has to be used with MBaccess locked
+ */
+class MBCapture {
+
+public:
+    MBCapture();
+    ~MBCapture();
+
+    void Start(eCapMode eMode);
+    eCapMode GetMode()              { return eMode; }
+    bool isTriggered()              { return fTriggered; }
+    int GetRecords()                { return iRecords; }
+    bool Enabled()                  { return (eMode != CM_OFF) && (iPost != 0) && pRing; }   // frames are stored: callers skip the capture calls, all entry points check it first
+
+    void Request(uint8_t uServer, uint8_t uFC, uint16_t uAddr, uint16_t uWords);
+    void Request(const uint8_t *pFrame);
+    void Request(uint8_t uServer, uint8_t uFC, uint16_t uAddr, uint16_t uWords, const uint16_t *pValues);
+    void Response(const uint8_t *pFrame, uint16_t uLen);
+    void Failure(uint8_t uServer, uint8_t uFC, Error err);
+
+    size_t GetExportSize(void);
+    size_t Export(uint8_t *pDst, size_t uMax);
+
+private:
+    /// record header in ring buffer, followed by the frame
+    typedef struct {
+        int64_t llTime;     // [us] since boot
+        uint8_t uLen;       // frame size, 0: 256
+        uint8_t uType;      // eCapType
+        uint8_t uErr;       // error code for CR_ERROR, exception code of response
+        uint8_t uRes;
+    } mb_caprec_t;
+
+    void Add(eCapType eType, uint8_t uErr, const uint8_t *pFrame, uint16_t uLen);
+    void Put(size_t uPos, const void *pSrc, size_t uLen);
+    void Get(size_t uPos, void *pDst, size_t uLen);
+
+    uint8_t *pRing;         // allocated by Start()
+    size_t uHead;           // next write position
+    size_t uTail;           // oldest record
+    size_t uUsed;           // bytes in use
+    int iRecords;           // # of records in ring
+    eCapMode eMode;
+    bool fTriggered;        // error seen in CM_ERROR
+    int iPost;              // records left until capture stops
+};
+
+#endif
@@ -0,0 +1,89 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	MBDerived.h
+*
+* @brief:	derived channels of a meter: totals, power factor, imbalance and energy estimate
+* @author:	Dierk Arp
+* @date:	20261016 16:40:07
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+#ifndef _MBDERIVED_H_INCLUDED
+#define _MBDERIVED_H_INCLUDED
+
+#include <stdint.h>
+#include "MeterMap.h"
+
+#define MBD_MAX_GAP_MS       (10000)    // max. time between two power values integrated [ms], longer: gap in data
+#define MBD_COUNTER_RES_MWH  (10000)    // resolution of the energy counters: 0.01 kWh [mWh]
+
+/// values derived from the channels of a meter, plain copy
+typedef struct {
+    float fPowerTotal;              // sum of phase powers [W]
+    float fApparentTotal;           // sum of apparent powers [VA]
+    float fReactiveTotal;           // sum of reactive powers [VAr]
+    float afPowerFactor[3];         // power factor by phase: P / S, 0: no apparent power
+    float fPowerFactor;             // total power factor
+    float fImbalance;               // current imbalance: max. deviation from mean / mean [%], 0: single phase
+    int64_t llEnergyIn;             // estimated imported energy [mWh]
+    int64_t llEnergyOut;            // estimated exported energy [mWh]
+    int32_t lCorrection;            // last correction of the imported energy estimate by the counter [mWh]
+    bool fEnergyValid;              // counters read at least once
+} mb_derived_t;
+
+/**
+ * @brief derived channels, updated with each block read by the eModbus task
+ *        energy is integrated from the total power between counter reads (trapezoidal rule)
+ *        and pulled into the resolution interval of the counter when it is read
+ */
+class MBDerived {
+
+public:
+    MBDerived();
+
+    void SetStore(const mb_value_t *pvWork, const mb_chlayout_t *pLayout);
+    void Update(uint32_t ulChannels, uint32_t ulTime);
+    void Get(mb_derived_t &d) const;
+
+private:
+    float Value(eChannel ch) const  { uint8_t s = pL->auSlot[ch]; return (s != MB_CH_NONE) ? ValueToFloat(ch, pvCh[s]) : 0.0f; }
+    int64_t CounterMWh(eChannel ch) const;
+    bool Has(eChannel ch) const     { return pL->auSlot[ch] != MB_CH_NONE; }
+    void Integrate(float fPower, uint32_t ulTime);
+    static int64_t Correct(int64_t llEstimate, int64_t llCounter);
+
+    const mb_value_t *pvCh;         // working copy of channel store
+    const mb_chlayout_t *pL;        // slots of channels
+
+    mb_derived_t D;                 // current values, energy in mWh is computed from the accumulators
+    int64_t llInMJ;                 // energy accumulators [mJ = mWs]
+    int64_t llOutMJ;
+    float fLastPower;               // total power at last integration step [W]
+    uint32_t ulLastTime;            // time of last integration step [ms]
+    bool fLast;                     // last power value valid
+};
+
+#endif
@@ -0,0 +1,97 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	MBMetrics.h
+*
+* @brief:	lock-free request counters of the bus and the meters
+* @author:	Dierk Arp
+* @date:	20261016 15:02:18
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+#ifndef _MBMETRICS_H_INCLUDED
+#define _MBMETRICS_H_INCLUDED
+
+#include <atomic>
+#include "ModbusClientRTU.h"
+
+/// error classes of failed requests
+enum eErrClass
+{
+      EC_TIMEOUT,           // no response
+      EC_CRC,               // corrupted response
+      EC_EXCEPTION,         // exception response of device
+      EC_OTHER,             // other eModbus errors
+      EC_COUNT
+};
+
+#define MBM_RTT_BUCKETS      (12)       // round trip time histogram: <1ms, <2ms, <4ms ... <1024ms, more
+#define MBM_EXCEPTIONS       (12)       // exception codes 0x01..0x0B
+
+/// plain copy of the counters
+typedef struct {
+    uint32_t ulRequests;                    // requests handed to eModbus
+    uint32_t ulResponses;                   // data and exception responses
+    uint32_t ulTxBytes;                     // request frames incl. CRC
+    uint32_t ulRxBytes;                     // response frames incl. CRC
+    uint64_t ullBusyUs;                     // time the bus was held by requests incl. timeouts [us]
+    uint32_t aulErrors[EC_COUNT];           // failed requests by class
+    uint32_t aulExceptions[MBM_EXCEPTIONS]; // exception responses by code
+    uint32_t aulRtt[MBM_RTT_BUCKETS];       // responses by round trip time
+} mb_metrics_t;
+
+/**
+ * @brief request counters, updated by the eModbus handlers and read by any task without lock
+ *        except the 64 bit busy time: Fold() and Get() have to be called with MBaccess locked
+ */
+class MBMetrics {
+
+public:
+    MBMetrics();
+
+    void Request(uint16_t uBytes);
+    void Response(uint32_t ulRtt, uint16_t uBytes, uint32_t ulBusUs);
+    void Failure(Error err, uint32_t ulRtt, uint32_t ulBusUs);
+    void Get(mb_metrics_t &m);
+    void Fold(void);
+
+    static eErrClass ErrClass(Error err);
+    static uint32_t BucketLimit(int iBucket)   { return 1000UL << iBucket; }    // upper limit of histogram bucket [us]
+
+private:
+    static void Inc(std::atomic<uint32_t> &ul, uint32_t ulN = 1) { ul.fetch_add(ulN, std::memory_order_relaxed); }
+
+    std::atomic<uint32_t> ulRequests;
+    std::atomic<uint32_t> ulResponses;
+    std::atomic<uint32_t> ulTxBytes;
+    std::atomic<uint32_t> ulRxBytes;
+    std::atomic<uint32_t> ulBusyUs;       // busy time since last Fold() [us], lock-free unlike a 64 bit atomic on 32 bit cores
+    uint64_t ullBusyUs;                   // busy time folded from ulBusyUs [us], 32 bit would wrap after 71 minutes
+    std::atomic<uint32_t> aulErrors[EC_COUNT];
+    std::atomic<uint32_t> aulExceptions[MBM_EXCEPTIONS];
+    std::atomic<uint32_t> aulRtt[MBM_RTT_BUCKETS];
+};
+
+#endif
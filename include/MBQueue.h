@@ -0,0 +1,97 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	MBQueue.h
+*
+* @brief:	priority request queue in front of eModbus
+* @author:	Dierk Arp
+* @date:	20261016 13:20:41
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+#ifndef _MBQUEUE_H_INCLUDED
+#define _MBQUEUE_H_INCLUDED
+
+#include <stdint.h>
+
+/// request classes, in order of priority
+enum eReqPrio
+{
+      PRIO_CONTROL,         // writes
+      PRIO_INTERACTIVE,     // reads for TCP / HTTP clients
+      PRIO_POLL,            // scheduled block reads and connect requests
+      PRIO_DISCOVERY,       // bus discovery
+      PRIO_COUNT
+};
+
+#define MBQ_MAX_DEPTH       (16)        // max. entries of one class
+#define MBQ_AGING_MS        (2000)      // waiting this long raises an entry by one class
+
+/// queued request, the request context is created when it is handed to eModbus
+typedef struct {
+    uint32_t ulEnqueued;    // [ms]
+    uint32_t ulKey;         // order in class, lowest first: deadline, arrival or fair share
+    uint32_t ulDeadline;    // dropped if not started until then [ms]
+    bool     fDeadline;     // ulDeadline valid
+    uint8_t  uMeter;        // device slot or MB_CTX_x of request context
+    uint8_t  uBlock;        // block index, bridge transaction or fingerprint
+    uint8_t  uServer;       // device address
+    uint8_t  uFC;           // function code
+    uint16_t uAddr;         // first register
+    uint16_t uWords;        // # of registers
+    uint16_t uTimeout;      // response timeout [ms]
+} mb_qentry_t;
+
+typedef void (*mb_qdrop_t)(const mb_qentry_t &e);
+
+/**
+ * @brief multi level priority queue with aging, depth limits and deadlines
+ *        not thread safe: has to be used with MBaccess locked
+ */
+class MBQueue {
+
+public:
+    MBQueue();
+
+    void SetDepth(eReqPrio ePrio, uint8_t uDepth);
+    bool HasRoom(eReqPrio ePrio)    { return auN[ePrio] < auDepth[ePrio]; }
+    uint8_t GetDepth(eReqPrio ePrio) { return auN[ePrio]; }
+    uint32_t GetDropped(eReqPrio ePrio) { return aulDropped[ePrio]; }
+
+    bool Push(eReqPrio ePrio, const mb_qentry_t &e);
+    bool Remove(eReqPrio ePrio, uint8_t uMeter, uint8_t uBlock);
+    int Peek(uint32_t ulNow, mb_qdrop_t pfnDrop);
+    void Pop(int iPrio, mb_qentry_t &e);
+
+private:
+    int Head(int iPrio);
+
+    mb_qentry_t aEntry[PRIO_COUNT][MBQ_MAX_DEPTH];
+    uint8_t auN[PRIO_COUNT];            // # of entries
+    uint8_t auDepth[PRIO_COUNT];        // depth limit
+    uint32_t aulDropped[PRIO_COUNT];    // # of entries dropped at deadline
+};
+
+#endif
@@ -0,0 +1,368 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	MeterMap.h
+*
+* @brief:	register maps of the supported Modbus meters
+* @author:	Dierk Arp
+* @date:	20261016 09:12:40
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+
+#ifndef _METERMAP_H_INCLUDED
+#define _METERMAP_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include "ModbusTypeDefs.h"
+
+/// defines the different supported Modbus meter types 
+enum eMeterType
+{
+      MT_SDM630,
+      MT_SDM230,
+      MT_SDM220, 
+      MT_SDM120,
+      MT_SDM72D, 
+      MT_DDM,
+      MT_FINDER,
+      MT_UNKNOWN
+};
+
+/// meter values (channels) a register can be decoded into
+enum eChannel
+{
+      CH_VOLTAGE_1,         // voltages on phase        [V]
+      CH_VOLTAGE_2,
+      CH_VOLTAGE_3,
+      CH_CURRENT_1,         // current on phase         [A]
+      CH_CURRENT_2,
+      CH_CURRENT_3,
+      CH_POWER_1,           // power on phase           [W]
+      CH_POWER_2,
+      CH_POWER_3,
+      CH_APPARENT_POWER_1,  // apparent Power on phase  [VA]
+      CH_APPARENT_POWER_2,
+      CH_APPARENT_POWER_3,
+      CH_REACTIVE_POWER_1,  // reactive Power on phase  [VAr]
+      CH_REACTIVE_POWER_2,
+      CH_REACTIVE_POWER_3,
+      CH_FREQUENCY,         // line frequency           [Hz]
+      CH_ENERGY_IN,         // el. energy production    [kWh]
+      CH_ENERGY_OUT,        // el. energy consumption   [kWh]
+      CH_COUNT
+};
+
+//
+// representation of channel values: float, with MB_FIXED_CHANNELS scaled integers in the unit of GetFixedFormat()
+//
+#ifdef MB_FIXED_CHANNELS
+typedef int32_t mb_value_t;
+#define MB_VALUE_NONE       (INT32_MIN)         // no value yet
+#else
+typedef float mb_value_t;
+#define MB_VALUE_NONE       (NAN)
+#endif
+
+/// fixed point format of a channel
+typedef struct {
+    int32_t lScale;         // fixed point units per unit of channel, e.g. 1000: mV for a voltage
+    uint8_t uDecimals;      // decimal digits of lScale
+} mb_fixfmt_t;
+
+/// deadband of a channel: a value has changed, if it moves more than max(fAbs, fRel * |last reported value|)
+typedef struct {
+    float fAbs;             // absolute deadband [unit of channel]
+    float fRel;             // relative deadband, 0.01: 1 %
+} mb_deadband_t;
+
+/// data type of a register value
+enum eDataType
+{
+      DT_FLOAT,             // IEEE 754 float, 2 words
+      DT_U16,               // unsigned int, 1 word
+      DT_U32                // unsigned int, 2 words
+};
+
+/// poll rate class of a register value
+enum ePollClass
+{
+      PC_FAST,              // power values
+      PC_NORMAL,            // voltage, frequency
+      PC_SLOW,              // energy counters
+      PC_COUNT
+};
+
+#define MB_POLL_FAST_MS     (1000)      // poll interval of PC_FAST   [ms]
+#define MB_POLL_NORMAL_MS   (5000)      // poll interval of PC_NORMAL [ms]
+#define MB_POLL_SLOW_MS     (60000)     // poll interval of PC_SLOW   [ms]
+
+/// order of the words of a 2 word value
+enum eWordOrder
+{
+      WO_HIGH_FIRST,        // high word in lower register (Modbus standard)
+      WO_LOW_FIRST
+};
+
+//
+// read planner: single registers are merged into block reads
+//
+#define MB_MAX_BLOCK_WORDS  (125)       // Modbus limit for one read request
+#define MB_MAX_BLOCK_GAP    (8)         // max. unused registers bridged when merging two reads
+#define MB_MAX_BLOCKS       (8)         // max. block reads of one meter type
+
+/// describes one register value of a meter
+typedef struct {
+    uint8_t    uFC;         // function code (READ_INPUT_REGISTER, READ_HOLD_REGISTER)
+    uint16_t   uAddr;       // register address
+    uint8_t    uWords;      // length in words
+    eDataType  eType;       // data type
+    float      fScale;      // value = raw * fScale
+    eWordOrder eOrder;      // word order of 2 word values
+    eChannel   eCh;         // target channel
+    ePollClass ePoll;       // poll rate
+} mb_regdesc_t;
+
+/// one multi register read request, covering several mb_regdesc_t
+typedef struct {
+    uint8_t  uFC;           // function code
+    uint16_t uStart;        // first register
+    uint16_t uWords;        // number of registers to read
+    uint8_t  uFirstReg;     // index of first covered register in register map
+    uint8_t  uNRegs;        // number of covered registers
+    ePollClass ePoll;       // poll rate of all covered registers
+} mb_block_t;
+
+#define MB_CH_NONE          (0xff)      // channel not provided by a meter type
+
+/// channels of one meter type: slot of each channel in the channel store of a meter
+typedef struct {
+    uint8_t auSlot[CH_COUNT];       // slot of channel, MB_CH_NONE: not provided
+    uint8_t uNChannels;             // # of slots used
+} mb_chlayout_t;
+
+/// complete register map and read plan of one meter type
+typedef struct {
+    const char         *pszName;    // type name
+    const mb_regdesc_t *pRegs;      // register map, sorted by function code and address
+    uint8_t             uNRegs;
+    const mb_chlayout_t *pLayout;   // channels generated from register map
+    const mb_block_t   *pBlocks;    // block reads generated from register map
+    uint8_t             uNBlocks;
+    uint8_t             uProbeFC;   // request used to check connection
+    uint16_t            uProbeAddr;
+    uint8_t             uProbeWords;
+} mb_metermap_t;
+
+/// register read that identifies a meter type in a bus discovery
+typedef struct {
+    eMeterType eType;       // meter type, if the register is readable
+    uint8_t    uFC;         // function code
+    uint16_t   uAddr;       // register only this type provides
+    uint8_t    uWords;
+} mb_fingerprint_t;
+
+/**
+ * @brief poll interval of a poll class in ms
+ */
+constexpr uint32_t PollInterval(ePollClass pc)
+{
+    return (pc == PC_FAST) ? MB_POLL_FAST_MS : ((pc == PC_NORMAL) ? MB_POLL_NORMAL_MS : MB_POLL_SLOW_MS);
+}
+
+/// read plan, generated at compile time from a register map
+template <size_t N>
+struct mb_plan_t {
+    mb_block_t aBlocks[N];
+    uint8_t    uNBlocks;
+};
+
+/**
+ * @brief check that a register map is sorted by function code and address and does not overlap
+ */
+template <size_t N>
+constexpr bool IsMapSorted(const mb_regdesc_t (&aRegs)[N])
+{
+    for (size_t i=1; i<N; i++)
+    {
+        if (aRegs[i-1].uFC > aRegs[i].uFC)
+            return false;
+        if ((aRegs[i-1].uFC == aRegs[i].uFC) && (aRegs[i-1].uAddr + aRegs[i-1].uWords > aRegs[i].uAddr))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief merge contiguous or nearly contiguous registers into the fewest block reads
+ *        two registers end up in the same block, if the gap between them is at most uMaxGap words
+ *        and the block does not exceed MB_MAX_BLOCK_WORDS. Only registers of the same poll class are merged.
+ *        e.g. SDM630: 0x0000..0x0005 (voltage), 0x0006..0x001D (current, power), 0x0046 (frequency) and 0x0048..0x004B (energy)
+ *        uMaxGap 0 for meters, that may not implement the registers in the gaps
+ */
+template <size_t N>
+constexpr mb_plan_t<N> PlanBlocks(const mb_regdesc_t (&aRegs)[N], uint16_t uMaxGap = MB_MAX_BLOCK_GAP)
+{
+    mb_plan_t<N> plan {};
+
+    for (size_t i=0; i<N; i++)
+    {
+        const mb_regdesc_t &r = aRegs[i];
+        uint16_t uEnd = r.uAddr + r.uWords;     // first register behind value
+
+        if (plan.uNBlocks > 0)
+        {
+            mb_block_t &b = plan.aBlocks[plan.uNBlocks-1];
+            if ( (b.uFC == r.uFC) && (b.ePoll == r.ePoll)
+                && (r.uAddr <= b.uStart + b.uWords + uMaxGap)
+                && (uEnd - b.uStart <= MB_MAX_BLOCK_WORDS) )
+            {
+                // extend current block
+                if (uEnd > b.uStart + b.uWords)
+                    b.uWords = uEnd - b.uStart;
+                b.uNRegs++;
+                continue;
+            }
+        }
+        // start new block
+        mb_block_t &b = plan.aBlocks[plan.uNBlocks++];
+        b.uFC = r.uFC;
+        b.uStart = r.uAddr;
+        b.uWords = r.uWords;
+        b.uFirstReg = i;
+        b.uNRegs = 1;
+        b.ePoll = r.ePoll;
+    }
+    return plan;
+}
+
+/**
+ * @brief assign a channel store slot to each channel in a register map, in eChannel order
+ *        a meter only stores the channels its type provides
+ */
+constexpr mb_chlayout_t ChannelLayout(const mb_regdesc_t *pRegs, size_t uNRegs)
+{
+    mb_chlayout_t layout {};
+
+    for (int ch=0; ch<CH_COUNT; ch++)
+    {
+        layout.auSlot[ch] = MB_CH_NONE;
+        for (size_t i=0; i<uNRegs; i++)
+        {
+            if (pRegs[i].eCh == ch)
+            {
+                layout.auSlot[ch] = layout.uNChannels++;
+                break;
+            }
+        }
+    }
+    return layout;
+}
+
+extern const mb_metermap_t *GetMeterMap(eMeterType mt);
+extern eMeterType GetMeterType(const char *pszName);
+extern const mb_fingerprint_t *GetFingerprints(int &iN);
+extern const mb_deadband_t *GetDeadband(eChannel ch);
+extern const mb_fixfmt_t *GetFixedFormat(eChannel ch);
+extern int FormatValue(char *pszBuf, size_t uSize, eChannel ch, mb_value_t v);
+
+/**
+ * @brief check for "no value yet"
+ */
+inline bool IsNoValue(mb_value_t v)
+{
+#ifdef MB_FIXED_CHANNELS
+    return v == MB_VALUE_NONE;
+#else
+    return isnan(v);
+#endif
+}
+
+/**
+ * @brief channel value in the unit of the channel, e.g. V
+ */
+inline float ValueToFloat(eChannel ch, mb_value_t v)
+{
+#ifdef MB_FIXED_CHANNELS
+    return (float)v / GetFixedFormat(ch)->lScale;
+#else
+    return v;
+#endif
+}
+
+#ifdef MB_FIXED_CHANNELS
+/**
+ * @brief fixed point value saturated to the range of mb_value_t, INT32_MIN is left for MB_VALUE_NONE
+ *        (e.g. an energy counter in Wh saturates at about 2.1 GWh)
+ */
+inline mb_value_t ClampValue(int64_t llV)
+{
+    if (llV > INT32_MAX)
+        return INT32_MAX;
+    if (llV < INT32_MIN + 1)
+        return INT32_MIN + 1;
+    return (int32_t)llV;
+}
+#endif
+
+/**
+ * @brief channel value from a value in the unit of the channel, rounded to the fixed point unit
+ */
+inline mb_value_t FloatToValue(eChannel ch, float f)
+{
+#ifdef MB_FIXED_CHANNELS
+    if (isnan(f))
+        return 0;
+    double dV = (double)f * GetFixedFormat(ch)->lScale;
+    if (dV >= (double)INT32_MAX)
+        return INT32_MAX;
+    if (dV <= (double)(INT32_MIN + 1))
+        return INT32_MIN + 1;
+    return ClampValue(llround(dV));
+#else
+    return f;
+#endif
+}
+
+/**
+ * @brief channel value of an integer register: raw * register scale, 
+ *        with MB_FIXED_CHANNELS integer arithmetic if register scale * fixed point scale is an integer (e.g. 0.01 kWh in Wh)
+ */
+inline mb_value_t RawToValue(const mb_regdesc_t *pR, uint32_t ulRaw)
+{
+#ifdef MB_FIXED_CHANNELS
+    float fFactor = pR->fScale * GetFixedFormat(pR->eCh)->lScale;
+    int32_t lFactor = (int32_t)lroundf(fFactor);
+    if ((lFactor > 0) && (fabsf(fFactor - lFactor) < 0.001f))
+        return ClampValue((int64_t)ulRaw * lFactor);
+    return FloatToValue(pR->eCh, ulRaw * pR->fScale);
+#else
+    return ulRaw * pR->fScale;
+#endif
+}
+
+#endif
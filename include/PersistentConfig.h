@@ -36,6 +36,7 @@
 #define _PERSISTENTCONFIG_H_INCLUDED
 
 #include "Preferences.h"
+#include "modbus.h"
 
 
 class PersistentConfig {
@@ -50,6 +51,14 @@ class PersistentConfig {
 
         String sMeterType;
 
+        // meters found by bus discovery, 0: discover on next boot
+        int iNMeters;
+        eMeterType aeMeterType[MAX_METERS];
+        uint16_t auMeterAddr[MAX_METERS];
+        uint32_t aulMaxAge[MAX_METERS];     // max. age of registers served by Modbus TCP [ms], 0: default
+
+        bool fAlignPolling;                 // read the power blocks of all meters together
+
 };
 
      
@@ -35,6 +35,14 @@
 #ifndef _GLOBALS_H
 #define _GLOBALS_H
 
+#ifdef NATIVE
+// host build of the data path (env:native): no board, no application modules
+#include <Arduino.h>
+#include "RemoteDebug.h"
+extern RemoteDebug Debug;
+#include "modbus.h"
+#else
+
 // The mother of all embedded development...
 #include <Arduino.h>
 #include "ttgov1.h"   // our board
@@ -105,6 +113,7 @@ extern String g_SSID ;
 
 extern PersistentConfig g_cfg;
 
+#endif // NATIVE
 
 
 #endif
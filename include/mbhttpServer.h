@@ -37,5 +37,7 @@
 
 void StartHTTP(void); 
 
+extern uint32_t g_restartTime;
+
 #endif
 
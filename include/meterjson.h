@@ -0,0 +1,48 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	meterjson.h
+*
+* @brief:	JSON representation of a meter
+* @author:	Dierk Arp
+* @date:	20261016 16:40:07
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+#ifndef _METERJSON_H_INCLUDED
+#define _METERJSON_H_INCLUDED
+
+#include <ArduinoJson.h>
+#include "modbus.h"
+
+#define MJ_ALL_CHANNELS     (0xffffffffUL)
+#define MJ_MEMBERS          (48)        // max. members MeterToJson() adds
+
+// JSON document of MeterToJson(): members, copied keys (F() strings) and, with MB_FIXED_CHANNELS, copied value texts
+#define MJ_JSON_SIZE        (JSON_OBJECT_SIZE(MJ_MEMBERS) + MJ_MEMBERS * 16 + CH_COUNT * 16)
+
+extern void MeterToJson(ModBusMeter *pM, JsonObject root, uint32_t ulMask = MJ_ALL_CHANNELS);
+
+#endif
@@ -34,21 +34,86 @@
 #ifndef _MODBUS_H_INCLUDED
 #define _MODBUS_H_INCLUDED
 
+#include <atomic>
 #include "ModbusClientRTU.h"
+#include "MeterMap.h"
+#include "MBQueue.h"
+#include "MBMetrics.h"
+#include "MBCapture.h"
+#include "MBDerived.h"
 
-/// defines the different supported Modbus meter types 
-enum eMeterType
+/// health state of a meter
+enum eMeterHealth
 {
-      MT_SDM630,
-      MT_SDM230,
-      MT_SDM220, 
-      MT_SDM120,
-      MT_SDM72D, 
-      MT_DDM,
-      MT_FINDER,
-      MT_UNKNOWN
+      MH_HEALTHY,           // all reads successful
+      MH_DEGRADED,          // transport errors, retry budget not exhausted
+      MH_OFFLINE            // not connected, reconnect with backoff
 };
 
+#define MAX_METERS           (32)       // max. meters on bus
+#define MB_ADDR_MIN          (1)        // Modbus server address range
+#define MB_ADDR_MAX          (247)
+#define MB_WRITE_MAX_REGS    (32)       // registers of one write job
+#define MB_BLOCK_PROBE       (0xff)     // pseudo block index of the connect request
+
+/// context of a request handed to eModbus, found by the token in O(1)
+typedef struct
+{
+    uint32_t ulIssueMicros;   // request handed to eModbus [us]
+    uint32_t ulCycle;         // read cycle of device at issue
+    uint8_t uMeter;           // device slot, MB_CTX_DISCOVERY: bus discovery
+    uint8_t uServer;          // device address
+    uint8_t uFC;              // function code
+    uint8_t uBlock;           // block index in read plan, MB_BLOCK_PROBE: connect request
+    uint8_t uGen;             // generation of slot, detects stale tokens
+    boolean fUsed;            // slot in use
+} mb_reqctx_t;
+
+/// holding register to write
+typedef struct
+{
+    uint16_t uAddr;           // register
+    uint16_t uValue;
+} mb_wreg_t;
+
+/// state of a write job
+enum eWriteState
+{
+      WS_UNKNOWN,           // no such job, or result overwritten by a newer job
+      WS_BUSY,              // queued or on the bus
+      WS_DONE,              // all registers written (and read back)
+      WS_FAILED,            // exception or transport error
+      WS_MISMATCH           // read back differs from written value
+};
+
+/// read request of a block, compiled once with the poll plan and resent every cycle
+typedef struct
+{
+    ModbusMessage Msg;              // request for eModbus: device address, function code, register, count
+    uint8_t abFrame[8];             // RTU frame incl. CRC as sent, for the frame capture
+} mb_reqframe_t;
+
+/// consistent copy of the channels of a meter, published at the end of each read cycle
+typedef struct
+{
+    uint32_t ulCycle;               // read cycle, 0: no complete cycle yet
+    uint32_t ulTime;                // time of publication [ms]
+    mb_value_t avChannel[CH_COUNT]; // values by eChannel, 0 if not provided by meter type, ValueToFloat() for the unit of the channel
+    uint32_t ulChanged;             // channels changed beyond their deadband in this cycle, bit by eChannel
+    mb_derived_t derived;           // totals, power factor, imbalance and energy estimate of the same cycle
+    int64_t allBlockTime[MB_MAX_BLOCKS];    // acquisition time of each block read [us since boot], 0: not read yet
+    uint32_t ulSkew;                // spread of the acquisition times of the fastest blocks of this cycle [us]
+} mb_snapshot_t;
+
+/// spread of the power block reads of all meters in one poll round
+typedef struct
+{
+    bool fAligned;                  // aligned polling on
+    uint32_t ulRounds;              // rounds with more than one power block read
+    uint32_t ulLast;                // spread of last round [us]
+    uint32_t ulMax;                 // max. spread [us]
+    uint32_t ulAvg;                 // running average of spread [us]
+} mb_alignstats_t;
 
 class ModBusMeter {
 
@@ -59,31 +124,63 @@ public :
     ~ModBusMeter();
 
     // modbus handler
-    void handleMeterData(ModbusMessage response, uint32_t token);
-    void handleMeterError(Error error, uint32_t token);
-    Error FireConnectRequest(void);
-    void FireDataRequest(void);
+    void handleMeterData(const uint8_t *pData, uint16_t uLen, const mb_reqctx_t &ctx, int64_t llAcquired = 0);
+    void handleMeterError(Error error, const mb_reqctx_t &ctx);
+
+    // scheduler
+    int GetDueBlock(uint32_t ulNow, uint32_t &ulDeadline);
+    void QueueBlock(int iBlock, uint32_t ulNow, mb_qentry_t &e);
+    void CountOverrun(void)             { iOverruns++; }
+    float GetBusTime(uint32_t baudrate);
+    void UpdateRtt(uint32_t ulRtt, uint32_t ulBusUs);
+    uint32_t GetTimeout(void);
+    const mb_reqframe_t *GetRequestFrame(int iBlock);
+    int GetAlignBlock(void)             { return iAlignBlock; }
+    uint32_t GetBlockInterval(int iBlock) { return PollInterval(pMap->pBlocks[iBlock].ePoll); }
+    int GetChannelBlock(eChannel ch);
 
     // access functions
-    void SetMeter(eMeterType mt = MT_SDM630, int iDevAddr = 1);
+    void SetMeter(eMeterType mt = MT_SDM630, int iDevAddr = 1, int iIdx = 0);
+
+    void SetChannelStore(mb_value_t *pvWork, mb_value_t *pvPublished, mb_value_t *pvReported) { pvChannel = pvWork; pvPublic = pvPublished; pvRef = pvReported; Derived.SetStore(pvWork, pMap->pLayout); }
+    int GetNumberOfChannels()           { return pMap->pLayout->uNChannels; }
+    void GetSnapshot(mb_snapshot_t &snap);
+    uint32_t GetChangedSince(uint32_t ulCycle);
 
-    float GetPhaseVoltage(int iPhase)   { return fPhaseVoltage[iPhase & 3]; }
-    float GetPhaseCurrent(int iPhase)   { return fPhaseCurrent[iPhase & 3]; }
-    float GetPhasePower(int iPhase)     { return fPhasePower[iPhase & 3]; }
-    float GetApparentPower(int iPhase)  { return fApparentPower[iPhase & 3]; } 
-    float GetReactivePower(int iPhase)  { return fReactivePower[iPhase & 3]; }
+    // shadow register image: raw block reads for Modbus TCP clients
+    int GetShadowSize()                 { return 2 * uShadowWords; }
+    void SetShadowStore(uint8_t *pStore) { pShadow = pStore; }
+    void SetShadowMaxAge(uint32_t ulMaxAge) { ulShadowMaxAge = ulMaxAge; }
+    Error ReadShadow(uint8_t uFC, uint16_t uAddr, uint16_t uWords, uint8_t *pDst);
+
+    // single values of last published cycle, use GetSnapshot() for values of the same cycle
+    float GetChannel(eChannel ch)       { uint8_t s = pMap->pLayout->auSlot[ch]; return ((s != MB_CH_NONE) && pvPublic) ? ValueToFloat(ch, pvPublic[s]) : 0.0; }
+    float GetPhaseVoltage(int iPhase)   { return GetChannel((eChannel)(CH_VOLTAGE_1 + Phase(iPhase))); }
+    float GetPhaseCurrent(int iPhase)   { return GetChannel((eChannel)(CH_CURRENT_1 + Phase(iPhase))); }
+    float GetPhasePower(int iPhase)     { return GetChannel((eChannel)(CH_POWER_1 + Phase(iPhase))); }
+    float GetApparentPower(int iPhase)  { return GetChannel((eChannel)(CH_APPARENT_POWER_1 + Phase(iPhase))); } 
+    float GetReactivePower(int iPhase)  { return GetChannel((eChannel)(CH_REACTIVE_POWER_1 + Phase(iPhase))); }
   
-    float GetFrequency()  { return fFrequency; }  
-    float GetEnergyOut()  { return fEnergyOut; }
-    float GetEnergyIn()   { return fEnergyIn; }
+    float GetFrequency()  { return GetChannel(CH_FREQUENCY); }  
+    float GetEnergyOut()  { return GetChannel(CH_ENERGY_OUT); }
+    float GetEnergyIn()   { return GetChannel(CH_ENERGY_IN); }
   
     boolean isConnected() { return fConnected; } 
+    eMeterHealth GetHealth() { return eHealth; }
+    const char *GetHealthText(void);
     uint32_t GetCycles()  { return iCycles; }
     uint16_t GetErrCnt()  { return iErrCnt; }         
     uint16_t GetLastErr() { return iLastErr; }   
+    uint32_t GetOverruns() { return iOverruns; }
+    float GetRttAvg()     { return fRttAvg / 1000.0; }         // response delay [ms]
+    float GetRttP99()     { return fRttP99 / 1000.0; }
+    float GetRttMax()     { return ulRttMax / 1000.0; }        // round trip time [ms]
+    MBMetrics &GetMetrics() { return Metrics; }
     
     uint16_t GetDeviceAddr()  { return iDeviceAddr; }     
+    uint16_t GetFWVersion()   { return uFWVersion; }
     String GetDeviceType()    { return MeterType2Text(eDeviceType); }
+    const char *GetDeviceTypeText() { return MeterType2Text(eDeviceType); }
 
 // helper member
 
@@ -91,36 +188,82 @@ public :
     eMeterType Text2MeterType(const String&  sDevText);
 
 private:
-    float toFloat(ModbusMessage response);
-    uint16_t toInt16(ModbusMessage response);
-    uint32_t toInt32(ModbusMessage response);
+    static int Phase(int iPhase)        { return ((iPhase >= 0) && (iPhase < 3)) ? iPhase : 0; }
+    uint32_t BackoffDelay(void);
+    void Publish(void);
+    uint32_t GetCycleSkew(void);
+    void CompileRequest(mb_reqframe_t &r, uint8_t uFC, uint16_t uAddr, uint16_t uWords);
+
+    void SetChannel(eChannel ch, mb_value_t vValue);
+    uint32_t DecodeBlock(const mb_block_t *pB, const uint8_t *pWords);
 
 
     //
-    // modbus meter data
+    // modbus meter data: the channels of the meter type, slot of a channel from pMap->pLayout
+    // the values of all meters are packed into one channel store.
+    // pvChannel is written block by block by the eModbus task, 
+    // copied to pvPublic at the end of a cycle under a seqlock: readers never block the bus
+    // values are float or, with MB_FIXED_CHANNELS, scaled integers (mb_value_t)
     //
-    // only for 3 phase meters (SDM 630)  all phases are read
-    float fPhaseVoltage[3];   // voltages on phase        [V]
-    float fPhaseCurrent[3];   // current on phase         [A]
-    float fPhasePower[3];     // power on phase           [A]
-    float fApparentPower[3];  // apparent Power on phase  [VA] 
-    float fReactivePower[3];  // reactive Power on phase  [VAr] 
-  
-    float fFrequency;         // line frequency           [Hz]
-    float fEnergyOut;         // el. energy consumption   [kWh]
-    float fEnergyIn;          // el. energy production    [kWh]
+    mb_value_t *pvChannel;              // working copy
+    mb_value_t *pvPublic;               // last complete cycle
+    std::atomic<uint32_t> ulSeq;        // seqlock of pvPublic, odd: update in progress
+    uint32_t ulPublicCycle;             // cycle of pvPublic
+    uint32_t ulPublicTime;              // publication time of pvPublic [ms]
+    uint32_t ulPublicSkew;              // spread of acquisition times in cycle of pvPublic [us]
+
+    // change detection: a channel has changed, if it left the deadband around its last reported value
+    mb_value_t *pvRef;                  // last reported values, MB_VALUE_NONE: none yet
+    uint32_t ulChanged;                 // channels changed in current cycle, bit by eChannel
+    uint32_t ulPublicChanged;           // channels changed in cycle of pvPublic
+    uint32_t aulChangeCycle[CH_COUNT];  // cycle of last change by eChannel, 0: never, under seqlock ulSeq
+
+    // derived channels: updated with each block read, published with pvPublic
+    MBDerived Derived;
+    mb_derived_t PublicDerived;
+
+    // shadow register image: data of each block read, big endian as on the bus
+    uint8_t *pShadow;                   // in shadow store
+    uint16_t uShadowWords;              // size of image [words]
+    uint16_t auShadowOff[MB_MAX_BLOCKS];    // offset of block in image [words]
+    uint32_t aulShadowTime[MB_MAX_BLOCKS];  // time of block read [ms], 0: never read
+
+    // acquisition time of block reads: end of request frame, when the device answers from its registers
+    int64_t allBlockTime[MB_MAX_BLOCKS];        // working copy [us since boot], 0: never read
+    int64_t allPublicBlockTime[MB_MAX_BLOCKS];  // cycle of pvPublic, under seqlock ulSeq
+    std::atomic<uint32_t> ulShadowSeq;  // seqlock of image, odd: update in progress
+    uint32_t ulShadowMaxAge;            // max. age of served registers [ms], 0: 3 poll intervals
   
     // communication status 
     boolean fConnected;       // are we connected
+    eMeterHealth eHealth;     // health state
+    int iRetryBudget;         // transport errors left until offline
+    int iBackoff;             // # of failed connect requests
     uint32_t iCycles;         // # of read cycles
     uint16_t iErrCnt;         // # communication errors
     uint16_t iLastErr;        // # of last error
-    uint16_t uFWVersion;      // firmware version register (SDM?  todo)
+    uint32_t iOverruns;       // # of block reads that missed a complete poll interval or were dropped
+    uint16_t uFWVersion;      // firmware version of the device, read by the connect request (Finder), 0: unknown
 
     // 
     eMeterType eDeviceType;    // type of device 
     uint16_t iDeviceAddr;      // address on Modbus
+    int iMeterIdx;             // index in meter list
+    const mb_metermap_t *pMap; // register map and read plan of device type
 
+    // scheduler
+    uint32_t aulDue[MB_MAX_BLOCKS];  // next poll of block reads [ms]
+    uint32_t ulProbeDue;             // next connect request     [ms]
+    uint8_t uCycleBlock;             // block that completes a cycle
+    int8_t iAlignBlock;              // block with power of phase 1, on the common grid with aligned polling, -1: none
+    mb_reqframe_t aReqFrame[MB_MAX_BLOCKS + 1];  // block reads, connect request last
+
+    // response timing
+    uint32_t ulRttN;                 // # of timed responses
+    float fRttAvg;                   // average response delay of device [us]
+    float fRttP99;                   // running p99 of response delay [us]
+    uint32_t ulRttMax;               // max. round trip time [us]
+    MBMetrics Metrics;               // request counters of device
 };
 
 
@@ -128,6 +271,39 @@ extern void StartModBus(uint32_t baudrate, int iNMeters, eMeterType *dt, uint16_
 extern void ModBusHandle(void);
 extern ModBusMeter *GetMeterDataPtr(int idx);
 extern int GetNumberOfMeters(void);
+extern const mb_value_t *GetChannelStore(int &iNValues);
+
+// bus discovery
+typedef void (*mb_discovery_cb_t)(int iN, eMeterType *dt, uint16_t *devadr);
+extern bool StartDiscovery(mb_discovery_cb_t pfnDone);
+extern const char *GetDiscoveryState(int &iAddr, int &iFound);
+
+// TCP to RTU bridge
+extern Error BridgeRead(void *pClient, uint8_t uServer, uint8_t uFC, uint16_t uAddr, uint16_t uWords, uint8_t *pDst, uint32_t ulTimeout);
+extern uint32_t GetBusLoad(void);
+extern uint32_t GetBaudrate(void);
+extern uint32_t GetBusOverruns(void);
+
+// aligned polling: power blocks of all meters read together
+extern void SetAlignedPolling(bool fOn);
+extern void GetAlignStats(mb_alignstats_t &s);
+
+// register writes
+extern int WriteRegisters(int iServer, const mb_wreg_t *pRegs, int iN, bool fVerify);
+extern eWriteState GetWriteResult(int iJob, Error &err, uint16_t &uAddr);
+extern const char *WriteState2Text(eWriteState eState);
+
+// metrics
+extern void GetBusMetrics(mb_metrics_t &m);
+extern void GetMeterMetrics(int idx, mb_metrics_t &m);
+extern uint32_t GetBusUtilization(void);
+extern int GetQueueDepth(eReqPrio ePrio);
+extern int GetInFlight(void);
+
+// frame capture
+extern void StartCapture(eCapMode eMode);
+extern eCapMode GetCaptureState(int &iRecords, bool &fTriggered);
+extern uint8_t *ExportCapture(size_t &uLen);
 
 
 #endif
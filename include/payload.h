@@ -0,0 +1,46 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	payload.h
+*
+* @brief:	LoRaWAN uplink payload of a meter
+* @author:	Dierk Arp
+* @date:	20261016 16:40:07
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+#ifndef _PAYLOAD_H_INCLUDED
+#define _PAYLOAD_H_INCLUDED
+
+#include "modbus.h"
+
+#define PAYLOAD_METER_SIZE  (3*sizeof(float))   // energy in, energy out, power L1
+#define PAYLOAD_WRITE_PORT  (10)                // downlink port of register writes
+#define PAYLOAD_WRITE_VERIFY (0x01)             // flag of write downlink: read back registers
+
+extern int PackMeterPayload(ModBusMeter *pM, uint8_t *pBuf, int iSize);
+extern int UnpackWriteDownlink(const uint8_t *pBuf, int iLen, uint8_t &uServer, bool &fVerify, mb_wreg_t *pRegs, int iMax);
+
+#endif
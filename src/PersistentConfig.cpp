@@ -47,10 +47,14 @@ static const char TAG[] = __FILE__;
 #include "modbus.h"
 #include "PersistentConfig.h"
 
+// JSON document: metertype, meters and align, each meter with type, addr and maxage, plus copied keys and texts
+#define CONFIG_JSON_SIZE    (JSON_OBJECT_SIZE(3) + JSON_ARRAY_SIZE(MAX_METERS) + MAX_METERS * (JSON_OBJECT_SIZE(3) + 40) + 128)
 
 PersistentConfig::PersistentConfig()
 {
     sMeterType = "SDM630";
+    iNMeters = 0;
+    fAlignPolling = false;
 }
 
 PersistentConfig::~PersistentConfig()
@@ -75,7 +79,7 @@ bool PersistentConfig::Load()
 
     size_t size = configFile.size();
  
-    StaticJsonDocument<512> doc;
+    DynamicJsonDocument doc(CONFIG_JSON_SIZE);
     auto error = deserializeJson(doc, configFile);
     if (error) 
     {
@@ -88,6 +92,28 @@ bool PersistentConfig::Load()
     const char *pCC = doc["metertype"];
     ESP_LOGI(TAG, "Config: Metertype: %s", pCC);
     sMeterType = pCC;
+
+    iNMeters = 0;
+    JsonArray meters = doc["meters"];
+    for (JsonObject m : meters)
+    {
+        if (iNMeters >= MAX_METERS)
+            break;
+        // an unknown type has no connect request and no reads, it would never come online
+        eMeterType mt = GetMeterType(m["type"]);
+        int iAddr = m["addr"] | 0;
+        if ((mt == MT_UNKNOWN) || (iAddr < MB_ADDR_MIN) || (iAddr > MB_ADDR_MAX))
+        {
+            ESP_LOGW(TAG, "Config: meter %s at %d skipped", m["type"] | "?", iAddr);
+            continue;
+        }
+        aeMeterType[iNMeters] = mt;
+        auMeterAddr[iNMeters] = iAddr;
+        aulMaxAge[iNMeters] = m["maxage"] | 0;
+        iNMeters++;
+    }
+    ESP_LOGI(TAG, "Config: %d meters", iNMeters);
+    fAlignPolling = doc["align"] | false;
     return true;
 }
 
@@ -99,16 +125,32 @@ bool PersistentConfig::Load()
  */
 bool PersistentConfig::Save()
 {
+  DynamicJsonDocument doc(CONFIG_JSON_SIZE);
+  doc["metertype"] = sMeterType;
+
+  JsonArray meters = doc.createNestedArray("meters");
+  for (int i=0; i<iNMeters; i++)
+  {
+    JsonObject m = meters.createNestedObject();
+    m["type"] = GetMeterMap(aeMeterType[i])->pszName;
+    m["addr"] = auMeterAddr[i];
+    if (aulMaxAge[i])
+      m["maxage"] = aulMaxAge[i];
+  }
+  if (fAlignPolling)
+    doc["align"] = true;
+  if (doc.overflowed())
+  {
+    ESP_LOGE(TAG, "config of %d meters too large", iNMeters);
+    return false;
+  }
+
   File configFile = SPIFFS.open(F("/config.json"), "w");
   if (!configFile) 
   {
     ESP_LOGE(TAG, "save config failed");
     return false;
   }
-
-  StaticJsonDocument<512> doc;
-  doc["metertype"] = sMeterType;
-
   serializeJson(doc, configFile);
   configFile.close();
 
@@ -185,10 +185,12 @@ void dp_drawPage(dp_page_t dp)
             dp_printf(0, 0, FONT_NORMAL, 0, "%1.1d.Meter: %s", dp-DP_PAGE_METER_0+1, pM->GetDeviceType().c_str() );
             if (pM->isConnected())
             {
-              dp_printf(0, 3, FONT_SMALL, 0, "Power:   %.0f W", pM->GetPhasePower(0));
-              dp_printf(0, 4, FONT_SMALL, 0, "In:      %.1f kWh", pM->GetEnergyIn() );
-              dp_printf(0, 5, FONT_SMALL, 0, "Out:     %.1f kWh", pM->GetEnergyOut() );
-              dp_printf(0, 6, FONT_SMALL, 0, "Line:    %.1f V", pM->GetPhaseVoltage(0) );
+              mb_snapshot_t snap;
+              pM->GetSnapshot(snap);
+              dp_printf(0, 3, FONT_SMALL, 0, "Power:   %.0f W", ValueToFloat(CH_POWER_1, snap.avChannel[CH_POWER_1]));
+              dp_printf(0, 4, FONT_SMALL, 0, "In:      %.1f kWh", ValueToFloat(CH_ENERGY_IN, snap.avChannel[CH_ENERGY_IN]) );
+              dp_printf(0, 5, FONT_SMALL, 0, "Out:     %.1f kWh", ValueToFloat(CH_ENERGY_OUT, snap.avChannel[CH_ENERGY_OUT]) );
+              dp_printf(0, 6, FONT_SMALL, 0, "Line:    %.1f V", ValueToFloat(CH_VOLTAGE_1, snap.avChannel[CH_VOLTAGE_1]) );
             }
             else
               dp_printf(0, 4, FONT_SMALL, 0, "not connected" );
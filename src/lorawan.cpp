@@ -45,6 +45,7 @@ static const char TAG[] = __FILE__;
 
 
 #include "lorawan.h"
+#include "payload.h"
 #include "loraconf.h"
 
 // Schedule TX every this many seconds (might become longer due to duty cycle limitations).
@@ -165,12 +166,10 @@ void do_send(osjob_t* j)
         ModBusMeter *pM = GetMeterDataPtr(0);
         if (pM)
         {
-          *(float *) &bTxBuffer[0] = pM->GetEnergyIn();
-          *(float *) &bTxBuffer[4] = pM->GetEnergyOut();
-          *(float *) &bTxBuffer[8] = pM->GetPhasePower(0);
+          int iLen = PackMeterPayload(pM, bTxBuffer, sizeof(bTxBuffer));
         
           // Prepare upstream data transmission at the next possible time.
-          LMIC_setTxData2(1, bTxBuffer, 3*sizeof(float), 0);
+          LMIC_setTxData2(1, bTxBuffer, iLen, 0);
           g_LoraData.nTX++;
           debugD( "Packet queued");
         }
@@ -180,6 +179,25 @@ void do_send(osjob_t* j)
     // Next TX is scheduled after TX_COMPLETE event.
 }
 
+/**
+ * @brief register write downlink: start the write, the result is logged and available by /api/write
+ */
+static void do_write(const uint8_t *pData, int iLen)
+{
+    mb_wreg_t aRegs[MB_WRITE_MAX_REGS];
+    uint8_t uServer;
+    bool fVerify;
+
+    int iN = UnpackWriteDownlink(pData, iLen, uServer, fVerify, aRegs, MB_WRITE_MAX_REGS);
+    if (iN <= 0)
+    {
+        debugW( "invalid write downlink, %d bytes", iLen);
+        return;
+    }
+    int iJob = WriteRegisters(uServer, aRegs, iN, fVerify);
+    debugI( "write downlink: %d registers of %d, job %d", iN, uServer, iJob);
+}
+
 /**
  * @brief Lora LMIC call back. 
  * 
@@ -237,9 +255,10 @@ void onEvent (ev_t ev)
             }
             if (LMIC.dataLen) 
             {
-              // TODO:  RX dispatcher
               debugD( "Received %dbytes of payload", LMIC.dataLen);
               g_LoraData.nRX++;
+              if ((LMIC.txrxFlags & TXRX_PORT) && (LMIC.frame[LMIC.dataBeg - 1] == PAYLOAD_WRITE_PORT))
+                do_write(&LMIC.frame[LMIC.dataBeg], LMIC.dataLen);
             }
             // Schedule next transmission
             os_setTimedCallback(&sendjob, os_getTime()+sec2osticks(TX_INTERVAL), do_send);
@@ -41,6 +41,7 @@ static const char TAG[] = __FILE__;
 #include "modbus.h"
 #include "lorawan.h"
 #include "mbhttpserver.h"
+#include "mbtcpserver.h"
 #include "i2c.h"
 #include "util.h"
 #include "PersistentConfig.h"
@@ -69,6 +70,23 @@ RemoteDebug Debug;
 ** some helper functions
 */
 
+/**
+ * @brief store meters found by bus discovery, the next boot skips the discovery
+ */
+static void saveDiscovery(int iN, eMeterType *dt, uint16_t *devadr)
+{
+  g_cfg.iNMeters = iN;
+  for (int i=0; i<iN; i++)
+  {
+    g_cfg.aeMeterType[i] = dt[i];
+    g_cfg.auMeterAddr[i] = devadr[i];
+    g_cfg.aulMaxAge[i] = 0;
+  }
+  if (!g_cfg.Save())
+    ESP_LOGE(TAG, "discovered meters not saved");
+  ModbusTCPRegisterMeters();
+}
+
 
 void setup() 
 {
@@ -185,9 +203,14 @@ void setup()
         // set to false later
         Debug.setSerialEnabled(true);
         
-        enum eMeterType meters[] = { MT_SDM230, MT_SDM630, MT_UNKNOWN, MT_UNKNOWN } ;
-        uint16_t devadr[] = {1, 2, 0, 0}; 
-        StartModBus (9600, 2,  meters, devadr);
+        // meters from last bus discovery, else discover them now
+        StartModBus (9600, g_cfg.iNMeters, g_cfg.aeMeterType, g_cfg.auMeterAddr);
+        if (g_cfg.iNMeters == 0)
+          StartDiscovery(saveDiscovery);
+        for (int i=0; i<GetNumberOfMeters(); i++)
+          GetMeterDataPtr(i)->SetShadowMaxAge(g_cfg.aulMaxAge[i]);
+        SetAlignedPolling(g_cfg.fAlignPolling);
+        StartModbusTCP();
         
         StartHTTP();
         otaInit();
@@ -213,6 +236,14 @@ void loop()
   SensorsHandle();
   loraHandle();
   Debug.handle();
+
+  // restart requested by http server
+  if (g_restartTime && ((int32_t)(millis() - g_restartTime) >= 0))
+  {
+    ESP_LOGI(TAG, "restart requested");
+    delay(100);
+    ESP.restart();
+  }
  
   // 
   // check every 5 sec for heap size and WIFI connection
@@ -0,0 +1,264 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	mbcapture.cpp
+*
+* @brief:	ring buffer of raw Modbus RTU frames, exported as pcap
+* @author:	Dierk Arp
+* @date:	20261016 16:40:07
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+
+#include <string.h>
+#include <esp_timer.h>
+#include "MBCapture.h"
+
+// pcap file format
+#define PCAP_MAGIC           (0xa1b2c3d4)
+#define PCAP_FILE_HDR        (24)
+#define PCAP_REC_HDR         (16)
+
+MBCapture::MBCapture()
+{
+    pRing = NULL;
+    eMode = CM_OFF;
+    Start(CM_OFF);
+}
+
+MBCapture::~MBCapture()
+{
+    delete [] pRing;
+}
+
+/**
+ * @brief clear buffer and (re)start capture
+ *        the buffer is allocated with the first capture
+ */
+void MBCapture::Start(eCapMode eNewMode)
+{
+    if ((eNewMode != CM_OFF) && (pRing == NULL))
+        pRing = new uint8_t[MBC_SIZE];
+    eMode = pRing ? eNewMode : CM_OFF;
+    uHead = 0;
+    uTail = 0;
+    uUsed = 0;
+    iRecords = 0;
+    fTriggered = false;
+    iPost = MBC_POST_RECORDS;
+}
+
+void MBCapture::Put(size_t uPos, const void *pSrc, size_t uLen)
+{
+    size_t uFirst = (uLen < MBC_SIZE - uPos) ? uLen : MBC_SIZE - uPos;
+
+    memcpy(pRing + uPos, pSrc, uFirst);
+    memcpy(pRing, (const uint8_t *)pSrc + uFirst, uLen - uFirst);
+}
+
+void MBCapture::Get(size_t uPos, void *pDst, size_t uLen)
+{
+    size_t uFirst = (uLen < MBC_SIZE - uPos) ? uLen : MBC_SIZE - uPos;
+
+    memcpy(pDst, pRing + uPos, uFirst);
+    memcpy((uint8_t *)pDst + uFirst, pRing, uLen - uFirst);
+}
+
+/**
+ * @brief store a record, drop the oldest records if needed
+ *        only called while Enabled()
+ */
+void MBCapture::Add(eCapType eType, uint8_t uErr, const uint8_t *pFrame, uint16_t uLen)
+{
+    mb_caprec_t rec;
+    size_t uSize = sizeof(rec) + uLen;
+
+    while (MBC_SIZE - uUsed < uSize)
+    {
+        mb_caprec_t old;
+        Get(uTail, &old, sizeof(old));
+        size_t uOld = sizeof(old) + (old.uLen ? old.uLen : MBC_MAX_FRAME);
+        uTail = (uTail + uOld) % MBC_SIZE;
+        uUsed -= uOld;
+        iRecords--;
+    }
+
+    rec.llTime = esp_timer_get_time();
+    rec.uLen = (uint8_t)uLen;
+    rec.uType = eType;
+    rec.uErr = uErr;
+    rec.uRes = 0;
+    Put(uHead, &rec, sizeof(rec));
+    Put((uHead + sizeof(rec)) % MBC_SIZE, pFrame, uLen);
+    uHead = (uHead + uSize) % MBC_SIZE;
+    uUsed += uSize;
+    iRecords++;
+
+    if ((eMode == CM_ERROR) && fTriggered)
+        iPost--;
+}
+
+/**
+ * @brief read request handed to eModbus, frame with CRC as sent
+ */
+void MBCapture::Request(uint8_t uServer, uint8_t uFC, uint16_t uAddr, uint16_t uWords)
+{
+    if (!Enabled())
+        return;
+
+    uint8_t abFrame[8] = { uServer, uFC, (uint8_t)(uAddr >> 8), (uint8_t)uAddr, (uint8_t)(uWords >> 8), (uint8_t)uWords };
+    uint16_t uCRC = RTUutils::calcCRC(abFrame, 6);
+
+    abFrame[6] = uCRC & 0xff;
+    abFrame[7] = uCRC >> 8;
+    Request(abFrame);
+}
+
+/**
+ * @brief write request (FC16) handed to eModbus, frame with CRC as sent
+ */
+void MBCapture::Request(uint8_t uServer, uint8_t uFC, uint16_t uAddr, uint16_t uWords, const uint16_t *pValues)
+{
+    if (!Enabled())
+        return;
+
+    uint8_t abFrame[MBC_MAX_FRAME];
+    uint16_t uLen = 7 + 2 * uWords;
+
+    if (uLen > MBC_MAX_FRAME - 2)
+        return;
+    abFrame[0] = uServer;
+    abFrame[1] = uFC;
+    abFrame[2] = uAddr >> 8;
+    abFrame[3] = uAddr & 0xff;
+    abFrame[4] = uWords >> 8;
+    abFrame[5] = uWords & 0xff;
+    abFrame[6] = 2 * uWords;
+    for (int i=0; i<uWords; i++)
+    {
+        abFrame[7 + 2*i] = pValues[i] >> 8;
+        abFrame[8 + 2*i] = pValues[i] & 0xff;
+    }
+    uint16_t uCRC = RTUutils::calcCRC(abFrame, uLen);
+    abFrame[uLen++] = uCRC & 0xff;
+    abFrame[uLen++] = uCRC >> 8;
+    Add(CR_REQUEST, 0, abFrame, uLen);
+}
+
+/**
+ * @brief read request from a compiled frame, 8 bytes incl. CRC
+ */
+void MBCapture::Request(const uint8_t *pFrame)
+{
+    if (!Enabled())
+        return;
+    Add(CR_REQUEST, 0, pFrame, 8);
+}
+
+/**
+ * @brief response frame without CRC, as delivered by eModbus
+ */
+void MBCapture::Response(const uint8_t *pFrame, uint16_t uLen)
+{
+    if (!Enabled())
+        return;
+
+    uint8_t abFrame[MBC_MAX_FRAME];
+
+    if (uLen > MBC_MAX_FRAME - 2)
+        uLen = MBC_MAX_FRAME - 2;
+    memcpy(abFrame, pFrame, uLen);
+    uint16_t uCRC = RTUutils::calcCRC(abFrame, uLen);
+    abFrame[uLen++] = uCRC & 0xff;
+    abFrame[uLen++] = uCRC >> 8;
+    Add(CR_RESPONSE, (abFrame[1] & 0x80) ? abFrame[2] : 0, abFrame, uLen);
+}
+
+/**
+ * @brief failed request: exception responses are stored as frame, other errors as error record
+ *        the first error triggers CM_ERROR
+ */
+void MBCapture::Failure(uint8_t uServer, uint8_t uFC, Error err)
+{
+    if (!Enabled())
+        return;
+
+    if (err < TIMEOUT)
+    {
+        uint8_t abExc[3] = { uServer, (uint8_t)(uFC | 0x80), (uint8_t)err };
+        Response(abExc, sizeof(abExc));
+    }
+    else
+    {
+        uint8_t abId[2] = { uServer, uFC };
+        Add(CR_ERROR, err, abId, sizeof(abId));
+    }
+    fTriggered = true;
+}
+
+/**
+ * @brief size of pcap image of all records
+ */
+size_t MBCapture::GetExportSize(void)
+{
+    return PCAP_FILE_HDR + iRecords * (PCAP_REC_HDR + MBC_PSEUDO_HDR - sizeof(mb_caprec_t)) + uUsed;
+}
+
+/**
+ * @brief write all records as pcap image, oldest first
+ *        link type USER0, each packet: pseudo header (eCapType, error code) and RTU frame incl. CRC
+ * 
+ * @param pDst      [out] buffer
+ * @param uMax      size of buffer, GetExportSize()
+ * @return size_t   size of image, 0: buffer too small
+ */
+size_t MBCapture::Export(uint8_t *pDst, size_t uMax)
+{
+    if (uMax < GetExportSize())
+        return 0;
+
+    uint32_t aulFile[6] = { PCAP_MAGIC, 2 | (4UL << 16), 0, 0, MBC_MAX_FRAME + MBC_PSEUDO_HDR, MBC_LINKTYPE };
+    uint8_t *p = pDst;
+    memcpy(p, aulFile, sizeof(aulFile));
+    p += sizeof(aulFile);
+
+    size_t uPos = uTail;
+    for (int i=0; i<iRecords; i++)
+    {
+        mb_caprec_t rec;
+        Get(uPos, &rec, sizeof(rec));
+        uint32_t ulLen = rec.uLen ? rec.uLen : MBC_MAX_FRAME;
+        uint32_t aulRec[4] = { (uint32_t)(rec.llTime / 1000000), (uint32_t)(rec.llTime % 1000000), ulLen + MBC_PSEUDO_HDR, ulLen + MBC_PSEUDO_HDR };
+
+        memcpy(p, aulRec, sizeof(aulRec));
+        p += sizeof(aulRec);
+        *p++ = rec.uType;
+        *p++ = rec.uErr;
+        Get((uPos + sizeof(rec)) % MBC_SIZE, p, ulLen);
+        p += ulLen;
+        uPos = (uPos + sizeof(rec) + ulLen) % MBC_SIZE;
+    }
+    return p - pDst;
+}
@@ -0,0 +1,223 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	mbderived.cpp
+*
+* @brief:	derived channels of a meter: totals, power factor, imbalance and energy estimate
+* @author:	Dierk Arp
+* @date:	20261016 16:40:07
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+#include <string.h>
+#include <math.h>
+#include "MBDerived.h"
+
+#define MBD_MJ_PER_MWH      (3600)      // 1 mWh = 3600 mWs
+
+#define MBD_CH(ch)          (1UL << (ch))
+#define MBD_PHASES(ch)      (MBD_CH(ch) | MBD_CH(ch + 1) | MBD_CH(ch + 2))
+#define MBD_POWER           (MBD_PHASES(CH_POWER_1))
+#define MBD_ANY_POWER       (MBD_POWER | MBD_PHASES(CH_APPARENT_POWER_1) | MBD_PHASES(CH_REACTIVE_POWER_1))
+#define MBD_CURRENT         (MBD_PHASES(CH_CURRENT_1))
+#define MBD_ENERGY          (MBD_CH(CH_ENERGY_IN) | MBD_CH(CH_ENERGY_OUT))
+
+MBDerived::MBDerived()
+{
+    SetStore(NULL, NULL);
+}
+
+/**
+ * @brief set the channels to derive from, resets all derived values
+ * 
+ * @param pvWork    working copy of the channel store of the meter
+ * @param pLayout   slots of the channels in the store
+ */
+void MBDerived::SetStore(const mb_value_t *pvWork, const mb_chlayout_t *pLayout)
+{
+    pvCh = pvWork;
+    pL = pLayout;
+    memset(&D, 0, sizeof(D));
+    llInMJ = 0;
+    llOutMJ = 0;
+    fLastPower = 0.0;
+    ulLastTime = 0;
+    fLast = false;
+}
+
+static float PowerFactor(float fP, float fS)
+{
+    if (fS <= 0.0f)
+        return 0.0f;
+    float fPF = fP / fS;
+    return (fPF > 1.0f) ? 1.0f : ((fPF < -1.0f) ? -1.0f : fPF);
+}
+
+/**
+ * @brief update the values derived from the channels of a block read
+ * 
+ * @param ulChannels    channels updated by the block, bit by eChannel
+ * @param ulTime        time of the block read [ms]
+ */
+void MBDerived::Update(uint32_t ulChannels, uint32_t ulTime)
+{
+    if (!pvCh || !pL)
+        return;
+
+    if (ulChannels & MBD_ANY_POWER)
+    {
+        D.fPowerTotal = 0.0f;
+        D.fApparentTotal = 0.0f;
+        D.fReactiveTotal = 0.0f;
+        for (int i=0; i<3; i++)
+        {
+            float fP = Value((eChannel)(CH_POWER_1 + i));
+            float fS = Value((eChannel)(CH_APPARENT_POWER_1 + i));
+            D.fPowerTotal += fP;
+            D.fApparentTotal += fS;
+            D.fReactiveTotal += Value((eChannel)(CH_REACTIVE_POWER_1 + i));
+            D.afPowerFactor[i] = PowerFactor(fP, fS);
+        }
+        D.fPowerFactor = PowerFactor(D.fPowerTotal, D.fApparentTotal);
+    }
+
+    if ((ulChannels & MBD_CURRENT) && Has(CH_CURRENT_3))
+    {
+        float fMean = (Value(CH_CURRENT_1) + Value(CH_CURRENT_2) + Value(CH_CURRENT_3)) / 3.0f;
+        float fDev = 0.0f;
+        for (int i=0; i<3; i++)
+            fDev = fmaxf(fDev, fabsf(Value((eChannel)(CH_CURRENT_1 + i)) - fMean));
+        D.fImbalance = (fMean > 0.0f) ? 100.0f * fDev / fMean : 0.0f;
+    }
+
+    if (ulChannels & MBD_POWER)
+        Integrate(D.fPowerTotal, ulTime);
+
+    if (ulChannels & MBD_ENERGY)
+    {
+        bool fFirst = !D.fEnergyValid;
+        if (Has(CH_ENERGY_IN))
+        {
+            int64_t llEst = llInMJ / MBD_MJ_PER_MWH;
+            int64_t llNew = Correct(fFirst ? -1 : llEst, CounterMWh(CH_ENERGY_IN));
+            D.lCorrection = fFirst ? 0 : (int32_t)(llNew - llEst);
+            if (fFirst || (llNew != llEst))
+                llInMJ = llNew * MBD_MJ_PER_MWH;
+        }
+        if (Has(CH_ENERGY_OUT))
+        {
+            int64_t llEst = llOutMJ / MBD_MJ_PER_MWH;
+            int64_t llNew = Correct(fFirst ? -1 : llEst, CounterMWh(CH_ENERGY_OUT));
+            if (fFirst || (llNew != llEst))
+                llOutMJ = llNew * MBD_MJ_PER_MWH;
+        }
+        D.fEnergyValid = true;
+    }
+}
+
+/**
+ * @brief integrate the total power with the trapezoidal rule, positive power is imported energy
+ *        a sign change between two values is split at the zero crossing
+ * 
+ * @param fPower    total power [W]
+ * @param ulTime    time of the value [ms]
+ */
+void MBDerived::Integrate(float fPower, uint32_t ulTime)
+{
+    uint32_t ulDt = ulTime - ulLastTime;
+
+    if (fLast && (ulDt > 0) && (ulDt <= MBD_MAX_GAP_MS))
+    {
+        float fArea[2];             // [mWs] before and after zero crossing
+        float fP0 = fLastPower;
+
+        if (fP0 * fPower < 0.0f)
+        {
+            float fTc = ulDt * fP0 / (fP0 - fPower);
+            fArea[0] = fP0 * fTc / 2.0f;
+            fArea[1] = fPower * (ulDt - fTc) / 2.0f;
+        }
+        else
+        {
+            fArea[0] = (fP0 + fPower) * ulDt / 2.0f;
+            fArea[1] = 0.0f;
+        }
+        for (int i=0; i<2; i++)
+        {
+            if (fArea[i] > 0.0f)
+                llInMJ += llroundf(fArea[i]);
+            else
+                llOutMJ += llroundf(-fArea[i]);
+        }
+    }
+    fLastPower = fPower;
+    ulLastTime = ulTime;
+    fLast = true;
+}
+
+/**
+ * @brief energy counter of the meter in mWh, exact for MB_FIXED_CHANNELS
+ * 
+ * @param ch        CH_ENERGY_IN or CH_ENERGY_OUT
+ * @return int64_t  counter [mWh]
+ */
+int64_t MBDerived::CounterMWh(eChannel ch) const
+{
+    uint8_t s = pL->auSlot[ch];
+    if (s == MB_CH_NONE)
+        return 0;
+#ifdef MB_FIXED_CHANNELS
+    return (int64_t)pvCh[s] * 1000000 / GetFixedFormat(ch)->lScale;
+#else
+    return llround((double)pvCh[s] * 1000000.0);
+#endif
+}
+
+/**
+ * @brief correct an energy estimate by the counter of the meter: 
+ *        the true energy is between the counter value and the next step of the counter
+ * 
+ * @param llEstimate    estimate [mWh], < 0: none
+ * @param llCounter     counter [mWh]
+ * @return int64_t      corrected estimate [mWh]
+ */
+int64_t MBDerived::Correct(int64_t llEstimate, int64_t llCounter)
+{
+    if (llEstimate < llCounter)
+        return llCounter;
+    if (llEstimate >= llCounter + MBD_COUNTER_RES_MWH)
+        return llCounter + MBD_COUNTER_RES_MWH - 1;
+    return llEstimate;
+}
+
+/**
+ * @brief plain copy of the derived values
+ */
+void MBDerived::Get(mb_derived_t &d) const
+{
+    d = D;
+    d.llEnergyIn = llInMJ / MBD_MJ_PER_MWH;
+    d.llEnergyOut = llOutMJ / MBD_MJ_PER_MWH;
+}
@@ -39,6 +39,7 @@ static const char TAG[] = __FILE__;
 #include <ArduinoJson.h>
 #include <AsyncJson.h>
 #include <ESPAsyncWebServer.h>
+#include "meterjson.h"
 
 #ifdef SPIFFS_EDITOR
 #include "SPIFFSEditor.h"
@@ -51,6 +52,11 @@ static const char TAG[] = __FILE__;
 #define CONTENT_TYPE_JSON "application/json"
 #define CONTENT_TYPE_PLAIN "text/plain"
 #define CONTENT_TYPE_HTML "text/html"
+#define CONTENT_TYPE_PCAP "application/vnd.tcpdump.pcap"
+
+// JSON documents: members of all objects plus copied keys and texts
+#define STATUS_JSON_SIZE    (JSON_OBJECT_SIZE(15) + JSON_OBJECT_SIZE(3) + 640)
+#define DISCOVERY_JSON_SIZE (JSON_OBJECT_SIZE(4) + JSON_ARRAY_SIZE(MAX_METERS) + MAX_METERS * (JSON_OBJECT_SIZE(2) + 16) + 64)
 
 
 uint32_t g_restartTime = 0;
@@ -120,7 +126,7 @@ void handleGetStatus(AsyncWebServerRequest *request)
 {
   debugD("%s (%d args)", request->url().c_str(), request->params());
 
-  AsyncJsonResponse * response = new AsyncJsonResponse();
+  AsyncJsonResponse * response = new AsyncJsonResponse(false, STATUS_JSON_SIZE);
   response->addHeader("Server","Modbus Gateway");
   JsonObject root = response->getRoot();
 
@@ -143,8 +149,19 @@ void handleGetStatus(AsyncWebServerRequest *request)
   root[F("uptime")] = millis();
   root[F("heap")] = heap;
   root[F("minheap")] = g_minFreeHeap;
+  root[F("maxblock")] = ESP.getMaxAllocHeap();
   root[F("lastaccess")] = g_lastAccessTime;
   root[F("resetcode")] = getResetReason(0);
+  root[F("busload")] = GetBusLoad();
+  root[F("overruns")] = GetBusOverruns();
+
+  int iRecords;
+  bool fTriggered;
+  static const char *aszCapMode[] = { "off", "always", "error" };
+  JsonObject capture = root.createNestedObject(F("capture"));
+  capture[F("mode")] = aszCapMode[GetCaptureState(iRecords, fTriggered)];
+  capture[F("records")] = iRecords;
+  capture[F("triggered")] = fTriggered;
 
   // reset free heap
   g_minFreeHeap = heap;
@@ -161,48 +178,286 @@ void handleGetPowerMeter(AsyncWebServerRequest *request)
 {
   debugD("%s (%d args)", request->url().c_str(), request->params());
 
-  AsyncJsonResponse * response = new AsyncJsonResponse();
+  AsyncJsonResponse * response = new AsyncJsonResponse(false, MJ_JSON_SIZE);
   response->addHeader("Server","Modbus Gateway");
   JsonObject root = response->getRoot();
 
   int iMIdx = 0;
-  if (request->hasParam("1"))
-    iMIdx = 1;
-  if (request->hasParam("2"))
-    iMIdx = 1;
-  if (request->hasParam("3"))
+  if (request->hasParam("meter"))
+    iMIdx = request->getParam("meter")->value().toInt();
+  else if (request->hasParam("1"))
     iMIdx = 1;
+  else if (request->hasParam("2"))
+    iMIdx = 2;
+  else if (request->hasParam("3"))
+    iMIdx = 3;
 
+  // since=<cycle>: only values changed after that cycle
   ModBusMeter *pM = GetMeterDataPtr(iMIdx);
-  if (pM)
+  uint32_t ulMask = MJ_ALL_CHANNELS;
+  if (pM && request->hasParam("since"))
+    ulMask = pM->GetChangedSince(request->getParam("since")->value().toInt());
+
+  MeterToJson(pM, root, ulMask);
+  g_lastAccessTime = millis();
+
+  response->setLength();
+  request->send(response);
+}
+
+/**
+ * add request counters to a JSON object
+ */
+static void addMetrics(JsonObject obj, const mb_metrics_t &m, bool fExceptions)
+{
+  obj[F("req")] = m.ulRequests;
+  obj[F("rsp")] = m.ulResponses;
+  obj[F("tx")] = m.ulTxBytes;
+  obj[F("rx")] = m.ulRxBytes;
+  JsonArray err = obj.createNestedArray(F("err"));     // timeout, crc, exception, other
+  for (int i=0; i<EC_COUNT; i++)
+    err.add(m.aulErrors[i]);
+  if (fExceptions)
   {
-    root[F("connected")] = pM->isConnected();
-
-    root[F("frequency")] = pM->GetFrequency();
-    root[F("energy_out")] = pM->GetEnergyOut();
-    root[F("energy_in")] = pM->GetEnergyIn();
-    for (int i=0; i<3; i++)
-    {
-      char szBuf[32];
-      sprintf(szBuf, "u_%1.1d", i+1);
-      root[szBuf] = pM->GetPhaseVoltage(i);
-      sprintf(szBuf, "i_%1.1d", i+1);
-      root[szBuf] = pM->GetPhaseCurrent(i);
-      sprintf(szBuf, "p_%1.1d", i+1);
-      root[szBuf] = pM->GetPhasePower(i);
-      sprintf(szBuf, "ap_%1.1d", i+1);
-      root[szBuf] = pM->GetApparentPower(i);
-      sprintf(szBuf, "rp_%1.1d", i+1);
-      root[szBuf] = pM->GetReactivePower(i);
-    }
-    root[F("cycles")] = (unsigned long)pM->GetCycles();         
-    root[F("ErrCnt")] = (unsigned long)pM->GetErrCnt();        
-    root[F("DeviceAddr")] = (unsigned long)pM->GetDeviceAddr();   
-    root[F("DeviceType")] = pM->GetDeviceType();   
+    JsonArray exc = obj.createNestedArray(F("exc"));   // by exception code 0..11
+    for (int i=0; i<MBM_EXCEPTIONS; i++)
+      exc.add(m.aulExceptions[i]);
   }
-  else
+  JsonArray rtt = obj.createNestedArray(F("rtt"));     // <1ms, <2ms .. <1024ms, more
+  for (int i=0; i<MBM_RTT_BUCKETS; i++)
+    rtt.add(m.aulRtt[i]);
+}
+
+/**
+ * Bus and meter metrics JSON api
+ */
+void handleGetMetrics(AsyncWebServerRequest *request)
+{
+  debugD("%s (%d args)", request->url().c_str(), request->params());
+
+  int iN = GetNumberOfMeters();
+  AsyncJsonResponse * response = new AsyncJsonResponse(false, 1024 + iN * 512);
+  response->addHeader("Server","Modbus Gateway");
+  JsonObject root = response->getRoot();
+  mb_metrics_t m;
+
+  root[F("uptime")] = millis();
+  JsonObject bus = root.createNestedObject(F("bus"));
+  GetBusMetrics(m);
+  addMetrics(bus, m, true);
+  bus[F("busy")] = (long long)(m.ullBusyUs / 1000);
+  bus[F("util")] = GetBusUtilization();
+  bus[F("load")] = GetBusLoad();
+  bus[F("baud")] = GetBaudrate();
+  bus[F("inflight")] = GetInFlight();
+  JsonArray queue = bus.createNestedArray(F("queue"));   // control, interactive, poll, discovery
+  for (int i=0; i<PRIO_COUNT; i++)
+    queue.add(GetQueueDepth((eReqPrio)i));
+  mb_alignstats_t a;
+  GetAlignStats(a);
+  JsonObject align = bus.createNestedObject(F("align"));
+  align[F("on")] = a.fAligned;
+  align[F("rounds")] = a.ulRounds;
+  align[F("spread_us")] = a.ulLast;
+  align[F("spread_max_us")] = a.ulMax;
+  align[F("spread_avg_us")] = a.ulAvg;
+
+  JsonArray meters = root.createNestedArray(F("meters"));
+  for (int i=0; i<iN; i++)
+  {
+    ModBusMeter *pM = GetMeterDataPtr(i);
+    if (pM == NULL)
+      break;
+    JsonObject meter = meters.createNestedObject();
+    meter[F("addr")] = pM->GetDeviceAddr();
+    meter[F("type")] = pM->GetDeviceTypeText();
+    meter[F("delay")] = pM->GetRttAvg();
+    GetMeterMetrics(i, m);
+    addMetrics(meter, m, false);
+    meter[F("overruns")] = pM->GetOverruns();
+  }
+  g_lastAccessTime = millis();
+
+  response->setLength();
+  request->send(response);
+}
+
+/**
+ * Bus discovery JSON api
+ */
+void handleGetDiscovery(AsyncWebServerRequest *request)
+{
+  debugD("%s (%d args)", request->url().c_str(), request->params());
+
+  AsyncJsonResponse * response = new AsyncJsonResponse(false, DISCOVERY_JSON_SIZE);
+  response->addHeader("Server","Modbus Gateway");
+  JsonObject root = response->getRoot();
+
+  int iAddr, iFound;
+  root[F("state")] = GetDiscoveryState(iAddr, iFound);
+  root[F("addr")] = iAddr;
+  root[F("found")] = iFound;
+  JsonArray meters = root.createNestedArray(F("meters"));
+  for (int i=0; i<g_cfg.iNMeters; i++)
+  {
+    JsonObject m = meters.createNestedObject();
+    m[F("type")] = GetMeterMap(g_cfg.aeMeterType[i])->pszName;
+    m[F("addr")] = g_cfg.auMeterAddr[i];
+  }
+  g_lastAccessTime = millis();
+
+  response->setLength();
+  request->send(response);
+}
+
+/**
+ * Handle discovery request: forget discovered meters, discover again after restart
+ */
+void handleDiscover(AsyncWebServerRequest *request)
+{
+  debugI("%s (%d args)", request->url().c_str(), request->params());
+
+  g_cfg.iNMeters = 0;
+  if (!g_cfg.Save()) 
+  {
+    request->send(400, F(CONTENT_TYPE_PLAIN), F("Failed to save config file.\n"));
+    return;
+  }
+  requestRestart();
+  request->send(200, F(CONTENT_TYPE_PLAIN), F("Restart with bus discovery.\n"));
+}
+
+/**
+ * Download frame capture as pcap file
+ */
+void handleGetCapture(AsyncWebServerRequest *request)
+{
+  debugD("%s (%d args)", request->url().c_str(), request->params());
+
+  size_t uLen;
+  uint8_t *pImage = ExportCapture(uLen);
+  if (pImage == NULL)
+  {
+    request->send(404, F(CONTENT_TYPE_PLAIN), F("No capture.\n"));
+    return;
+  }
+
+  AsyncResponseStream *response = request->beginResponseStream(F(CONTENT_TYPE_PCAP));
+  response->addHeader("Content-Disposition", "attachment; filename=\"modbus.pcap\"");
+  response->write(pImage, uLen);
+  delete [] pImage;
+  g_lastAccessTime = millis();
+  request->send(response);
+}
+
+/**
+ * Handle capture request: start frame capture, mode off, always or error
+ */
+void handleCapture(AsyncWebServerRequest *request)
+{
+  debugI("%s (%d args)", request->url().c_str(), request->params());
+
+  eCapMode eMode = CM_ALWAYS;
+  AsyncWebParameter *pMode = request->hasParam("mode", true) ? request->getParam("mode", true) : request->getParam("mode");
+  if (pMode)
+  {
+    String sMode = pMode->value();
+    if (sMode.equalsIgnoreCase(F("off")))
+      eMode = CM_OFF;
+    else if (sMode.equalsIgnoreCase(F("error")))
+      eMode = CM_ERROR;
+  }
+  StartCapture(eMode);
+  request->send(200, F(CONTENT_TYPE_PLAIN), F("Capture started.\n"));
+}
+
+/**
+ * @brief parse registers to write: "reg:value,reg:value", decimal or 0x hex
+ * 
+ * @return int  # of registers, < 0: syntax error
+ */
+static int parseRegisters(const char *psz, mb_wreg_t *pRegs, int iMax)
+{
+  int iN = 0;
+  char *pEnd;
+
+  while (*psz)
+  {
+    if (iN >= iMax)
+      return -1;
+    unsigned long ulAddr = strtoul(psz, &pEnd, 0);
+    if ((pEnd == psz) || (*pEnd != ':') || (ulAddr > 0xffff))
+      return -1;
+    psz = pEnd + 1;
+    unsigned long ulValue = strtoul(psz, &pEnd, 0);
+    if ((pEnd == psz) || ((*pEnd != ',') && (*pEnd != 0)) || (ulValue > 0xffff))
+      return -1;
+    pRegs[iN].uAddr = ulAddr;
+    pRegs[iN++].uValue = ulValue;
+    psz = (*pEnd == ',') ? pEnd + 1 : pEnd;
+  }
+  return iN;
+}
+
+/**
+ * Handle write request: write holding registers of a device, result by GET /api/write?job=n
+ */
+void handleWrite(AsyncWebServerRequest *request)
+{
+  debugI("%s (%d args)", request->url().c_str(), request->params());
+
+  AsyncWebParameter *pAddr = request->hasParam("addr", true) ? request->getParam("addr", true) : request->getParam("addr");
+  AsyncWebParameter *pRegs = request->hasParam("regs", true) ? request->getParam("regs", true) : request->getParam("regs");
+  AsyncWebParameter *pVerify = request->hasParam("verify", true) ? request->getParam("verify", true) : request->getParam("verify");
+  mb_wreg_t aRegs[MB_WRITE_MAX_REGS];
+  int iN = pRegs ? parseRegisters(pRegs->value().c_str(), aRegs, MB_WRITE_MAX_REGS) : -1;
+  char *pEnd = NULL;
+  long lAddr = pAddr ? strtol(pAddr->value().c_str(), &pEnd, 0) : 0;
+  if (!pAddr || (*pEnd != 0) || (lAddr < MB_ADDR_MIN) || (lAddr > MB_ADDR_MAX) || (iN <= 0))
+  {
+    request->send(400, F(CONTENT_TYPE_PLAIN), F("Parameters: addr=<device 1..247>&regs=<reg>:<value>,...[&verify=0]\n"));
+    return;
+  }
+
+  bool fVerify = pVerify ? (pVerify->value().toInt() != 0) : true;
+  int iJob = WriteRegisters(lAddr, aRegs, iN, fVerify);
+  if (iJob < 0)
+  {
+    request->send(503, F(CONTENT_TYPE_PLAIN), F("Write not accepted: registers scattered or writes busy.\n"));
+    return;
+  }
+
+  AsyncJsonResponse * response = new AsyncJsonResponse();
+  response->addHeader("Server","Modbus Gateway");
+  JsonObject root = response->getRoot();
+  root[F("job")] = iJob;
+  g_lastAccessTime = millis();
+
+  response->setLength();
+  request->send(response);
+}
+
+/**
+ * Write result JSON api
+ */
+void handleGetWrite(AsyncWebServerRequest *request)
+{
+  debugD("%s (%d args)", request->url().c_str(), request->params());
+
+  int iJob = request->hasParam("job") ? request->getParam("job")->value().toInt() : -1;
+  Error err;
+  uint16_t uAddr;
+  eWriteState eState = GetWriteResult(iJob, err, uAddr);
+
+  AsyncJsonResponse * response = new AsyncJsonResponse();
+  response->addHeader("Server","Modbus Gateway");
+  JsonObject root = response->getRoot();
+  root[F("job")] = iJob;
+  root[F("state")] = WriteState2Text(eState);
+  if ((eState == WS_FAILED) || (eState == WS_MISMATCH))
   {
-    root[F("connected")] = false;
+    root[F("err")] = (int)err;
+    root[F("reg")] = uAddr;
   }
   g_lastAccessTime = millis();
 
@@ -392,11 +647,18 @@ void StartHTTP(void)
   g_server.on("/api/status", HTTP_GET, handleGetStatus);
   g_server.on("/api/meter", HTTP_GET, handleGetPowerMeter);
   g_server.on("/api/sensor", HTTP_GET, handleGetSensor);
+  g_server.on("/api/discover", HTTP_GET, handleGetDiscovery);
+  g_server.on("/api/metrics", HTTP_GET, handleGetMetrics);
+  g_server.on("/api/capture", HTTP_GET, handleGetCapture);
+  g_server.on("/api/write", HTTP_GET, handleGetWrite);
+  g_server.on("/api/write", HTTP_POST, handleWrite);
 
 
   // POST
 //  g_server.on("/update", HTTP_POST, handleUpdate );
   g_server.on("/settings", HTTP_POST, handleSettings );
+  g_server.on("/discover", HTTP_POST, handleDiscover );
+  g_server.on("/capture", HTTP_POST, handleCapture );
 
 
   // make sure config.json is not served!
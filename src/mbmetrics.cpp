@@ -0,0 +1,146 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	mbmetrics.cpp
+*
+* @brief:	lock-free request counters of the bus and the meters
+* @author:	Dierk Arp
+* @date:	20261016 15:02:18
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+
+#include "MBMetrics.h"
+
+#define MBM_EXCEPTION_BYTES  (5)        // id, fc | 0x80, code, CRC
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "counters of the eModbus handlers have to be lock-free");
+
+MBMetrics::MBMetrics()
+{
+    ulRequests = 0;
+    ulResponses = 0;
+    ulTxBytes = 0;
+    ulRxBytes = 0;
+    ulBusyUs = 0;
+    ullBusyUs = 0;
+    for (int i=0; i<EC_COUNT; i++)
+        aulErrors[i] = 0;
+    for (int i=0; i<MBM_EXCEPTIONS; i++)
+        aulExceptions[i] = 0;
+    for (int i=0; i<MBM_RTT_BUCKETS; i++)
+        aulRtt[i] = 0;
+}
+
+/**
+ * @brief request handed to eModbus
+ * 
+ * @param uBytes    size of request frame
+ */
+void MBMetrics::Request(uint16_t uBytes)
+{
+    Inc(ulRequests);
+    Inc(ulTxBytes, uBytes);
+}
+
+/**
+ * @brief data response received
+ * 
+ * @param ulRtt     round trip time [us]
+ * @param uBytes    size of response frame
+ * @param ulBusUs   time the request held the bus [us], without waiting behind other requests
+ */
+void MBMetrics::Response(uint32_t ulRtt, uint16_t uBytes, uint32_t ulBusUs)
+{
+    int iBucket = 0;
+
+    while ((iBucket < MBM_RTT_BUCKETS - 1) && (ulRtt >= BucketLimit(iBucket)))
+        iBucket++;
+    Inc(aulRtt[iBucket]);
+    Inc(ulResponses);
+    Inc(ulRxBytes, uBytes);
+    Inc(ulBusyUs, ulBusUs);
+}
+
+/**
+ * @brief request failed, an exception response counts as response
+ * 
+ * @param err       error of eModbus
+ * @param ulRtt     time until response or timeout [us]
+ * @param ulBusUs   time the request held the bus [us]
+ */
+void MBMetrics::Failure(Error err, uint32_t ulRtt, uint32_t ulBusUs)
+{
+    eErrClass ec = ErrClass(err);
+
+    Inc(aulErrors[ec]);
+    if (ec == EC_EXCEPTION)
+    {
+        if (err < MBM_EXCEPTIONS)
+            Inc(aulExceptions[err]);
+        Response(ulRtt, MBM_EXCEPTION_BYTES, ulBusUs);
+    }
+    else
+        Inc(ulBusyUs, ulBusUs);
+}
+
+/**
+ * @brief copy of all counters, single counters are consistent, the set is not
+ *        has to be called with MBaccess locked
+ */
+void MBMetrics::Get(mb_metrics_t &m)
+{
+    m.ulRequests = ulRequests.load(std::memory_order_relaxed);
+    m.ulResponses = ulResponses.load(std::memory_order_relaxed);
+    m.ulTxBytes = ulTxBytes.load(std::memory_order_relaxed);
+    m.ulRxBytes = ulRxBytes.load(std::memory_order_relaxed);
+    m.ullBusyUs = ullBusyUs + ulBusyUs.load(std::memory_order_relaxed);
+    for (int i=0; i<EC_COUNT; i++)
+        m.aulErrors[i] = aulErrors[i].load(std::memory_order_relaxed);
+    for (int i=0; i<MBM_EXCEPTIONS; i++)
+        m.aulExceptions[i] = aulExceptions[i].load(std::memory_order_relaxed);
+    for (int i=0; i<MBM_RTT_BUCKETS; i++)
+        m.aulRtt[i] = aulRtt[i].load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief move the busy time of the 32 bit counter to the 64 bit total, at least every 71 minutes
+ *        has to be called with MBaccess locked
+ */
+void MBMetrics::Fold(void)
+{
+    ullBusyUs += ulBusyUs.exchange(0, std::memory_order_relaxed);
+}
+
+eErrClass MBMetrics::ErrClass(Error err)
+{
+    if (err == TIMEOUT)
+        return EC_TIMEOUT;
+    if (err == CRC_ERROR)
+        return EC_CRC;
+    if (err < TIMEOUT)
+        return EC_EXCEPTION;
+    return EC_OTHER;
+}
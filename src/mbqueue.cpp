@@ -0,0 +1,154 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	mbqueue.cpp
+*
+* @brief:	priority request queue in front of eModbus
+* @author:	Dierk Arp
+* @date:	20261016 13:20:41
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+#include <string.h>
+#include "MBQueue.h"
+
+MBQueue::MBQueue()
+{
+    memset(auN, 0, sizeof(auN));
+    memset(aulDropped, 0, sizeof(aulDropped));
+    for (int i=0; i<PRIO_COUNT; i++)
+        auDepth[i] = MBQ_MAX_DEPTH;
+}
+
+void MBQueue::SetDepth(eReqPrio ePrio, uint8_t uDepth)
+{
+    auDepth[ePrio] = (uDepth < MBQ_MAX_DEPTH) ? uDepth : MBQ_MAX_DEPTH;
+}
+
+/**
+ * @brief queue a request
+ * 
+ * @return false    class full
+ */
+bool MBQueue::Push(eReqPrio ePrio, const mb_qentry_t &e)
+{
+    if (!HasRoom(ePrio))
+        return false;
+    aEntry[ePrio][auN[ePrio]++] = e;
+    return true;
+}
+
+/**
+ * @brief remove a request, that is not needed any more
+ * 
+ * @return false    not queued
+ */
+bool MBQueue::Remove(eReqPrio ePrio, uint8_t uMeter, uint8_t uBlock)
+{
+    for (int i=0; i<auN[ePrio]; i++)
+    {
+        if ((aEntry[ePrio][i].uMeter == uMeter) && (aEntry[ePrio][i].uBlock == uBlock))
+        {
+            aEntry[ePrio][i] = aEntry[ePrio][--auN[ePrio]];
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief entry of a class with the lowest key
+ * 
+ * @return int  index, -1: class empty
+ */
+int MBQueue::Head(int iPrio)
+{
+    int iHead = -1;
+
+    for (int i=0; i<auN[iPrio]; i++)
+    {
+        if ((iHead < 0) || ((int32_t)(aEntry[iPrio][i].ulKey - aEntry[iPrio][iHead].ulKey) < 0))
+            iHead = i;
+    }
+    return iHead;
+}
+
+/**
+ * @brief drop expired entries and find the class of the next request
+ *        a class is ranked by its priority, lowered by the waiting time of its head:
+ *        after MBQ_AGING_MS a poll is as urgent as a new interactive read, so no class starves
+ * 
+ * @param ulNow     current time [ms]
+ * @param pfnDrop   called for each entry dropped at its deadline, may be NULL
+ * @return int      class of next request, -1: queue empty
+ */
+int MBQueue::Peek(uint32_t ulNow, mb_qdrop_t pfnDrop)
+{
+    int iBest = -1;
+    int32_t lBestRank = 0;
+
+    for (int p=0; p<PRIO_COUNT; p++)
+    {
+        for (int i=0; i<auN[p]; )
+        {
+            mb_qentry_t &e = aEntry[p][i];
+            if (e.fDeadline && ((int32_t)(ulNow - e.ulDeadline) >= 0))
+            {
+                aulDropped[p]++;
+                if (pfnDrop)
+                    pfnDrop(e);
+                e = aEntry[p][--auN[p]];
+            }
+            else
+                i++;
+        }
+
+        int iHead = Head(p);
+        if (iHead < 0)
+            continue;
+        int32_t lRank = p * MBQ_AGING_MS - (int32_t)(ulNow - aEntry[p][iHead].ulEnqueued);
+        if ((iBest < 0) || (lRank < lBestRank))
+        {
+            iBest = p;
+            lBestRank = lRank;
+        }
+    }
+    return iBest;
+}
+
+/**
+ * @brief take the head of a class
+ * 
+ * @param iPrio     class from Peek()
+ * @param e         [out] request
+ */
+void MBQueue::Pop(int iPrio, mb_qentry_t &e)
+{
+    int iHead = Head(iPrio);
+    if (iHead < 0)
+        return;
+    e = aEntry[iPrio][iHead];
+    aEntry[iPrio][iHead] = aEntry[iPrio][--auN[iPrio]];
+}
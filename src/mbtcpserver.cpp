@@ -0,0 +1,138 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	mbtcpserver.cpp
+*
+* @brief:	Modbus TCP server for the RTU meters
+* @author:	Dierk Arp
+* @date:	20261016 11:05:12
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+static const char TAG[] = __FILE__;
+
+#include "globals.h"
+#include "ModbusServerWiFi.h"
+#include "mbtcpserver.h"
+
+//
+// Modbus TCP server: answers FC03/FC04 reads for each meter (unit id = RTU address)
+// from the shadow register image of the meter. TCP clients cause no traffic on the RTU bus,
+// unless they read registers outside of the poll plan: these are passed through to the bus.
+//
+#define MBTCP_MAX_CLIENTS   (4)         // concurrent client connections
+#define MBTCP_IDLE_TIMEOUT  (20000)     // close idle client connections [ms]
+#define MBTCP_BRIDGE_TIMEOUT (3000)     // max. wait for a read passed through to the RTU bus [ms]
+
+static ModbusServerWiFi MBserver;
+static int8_t aiUnitMeter[256];         // meter index of unit id, -1: no meter
+static boolean fStarted = false;
+
+/**
+ * @brief FC03/FC04 worker: read registers of a meter from its shadow image
+ * 
+ * @param request   server id, function code, first register, # of registers
+ * @return ModbusMessage  register values or exception response
+ */
+static ModbusMessage handleTcpRead(ModbusMessage request)
+{
+    ModbusMessage response;
+    uint8_t uUnit = request.getServerID();
+    uint8_t uFC = request.getFunctionCode();
+    uint16_t uAddr = 0;
+    uint16_t uWords = 0;
+
+    request.get(2, uAddr);
+    request.get(4, uWords);
+
+    int iMeter = aiUnitMeter[uUnit];
+    ModBusMeter *pM = (iMeter >= 0) ? GetMeterDataPtr(iMeter) : NULL;
+    if (pM == NULL)
+    {
+        response.setError(uUnit, uFC, GATEWAY_PATH_UNAVAIL);
+        return response;
+    }
+    if ((uWords == 0) || (uWords > MB_MAX_BLOCK_WORDS))
+    {
+        response.setError(uUnit, uFC, ILLEGAL_DATA_VALUE);
+        return response;
+    }
+
+    uint8_t abData[2 * MB_MAX_BLOCK_WORDS];
+    Error err = pM->ReadShadow(uFC, uAddr, uWords, abData);
+    if (err == ILLEGAL_DATA_ADDRESS)
+    {
+        // not in poll plan: read from device, each client connection has its own task
+        err = BridgeRead(xTaskGetCurrentTaskHandle(), uUnit, uFC, uAddr, uWords, abData, MBTCP_BRIDGE_TIMEOUT);
+        if (err >= TIMEOUT)
+            err = GATEWAY_TARGET_NO_RESP;
+    }
+    if (err != SUCCESS)
+    {
+        debugV("Modbus TCP: unit %d, FC %d, %d+%d: %02X", uUnit, uFC, uAddr, uWords, err);
+        response.setError(uUnit, uFC, err);
+        return response;
+    }
+
+    response.add(uUnit, uFC, (uint8_t)(2 * uWords));
+    response.add((const uint8_t *)abData, (uint16_t)(2 * uWords));
+    return response;
+}
+
+/**
+ * @brief register the read workers for the unit ids of all meters
+ *        again after the meters are set up by a bus discovery
+ */
+void ModbusTCPRegisterMeters(void)
+{
+    memset(aiUnitMeter, -1, sizeof(aiUnitMeter));
+    for (int i = 0; i<GetNumberOfMeters(); i++)
+    {
+        ModBusMeter *pM = GetMeterDataPtr(i);
+        if (pM == NULL)
+            continue;
+
+        uint8_t uUnit = pM->GetDeviceAddr();
+        aiUnitMeter[uUnit] = i;
+        MBserver.registerWorker(uUnit, READ_HOLD_REGISTER, &handleTcpRead);
+        MBserver.registerWorker(uUnit, READ_INPUT_REGISTER, &handleTcpRead);
+        debugD("Modbus TCP: unit %d -> meter %d", uUnit, i);
+    }
+}
+
+/**
+ * @brief start Modbus TCP server
+ * 
+ * @param uPort     TCP port (default: 502)
+ */
+void StartModbusTCP(uint16_t uPort)
+{
+    debugD("starting Modbus TCP server on port %d", uPort);
+    ModbusTCPRegisterMeters();
+    if (!fStarted)
+        fStarted = MBserver.start(uPort, MBTCP_MAX_CLIENTS, MBTCP_IDLE_TIMEOUT);
+    if (!fStarted)
+        debugE("Modbus TCP server not started");
+}
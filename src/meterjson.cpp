@@ -0,0 +1,116 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	meterjson.cpp
+*
+* @brief:	JSON representation of a meter
+* @author:	Dierk Arp
+* @date:	20261016 16:40:07
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+#include "meterjson.h"
+
+/// JSON keys of the channels, in order of output
+static const struct
+{
+    eChannel ch;
+    const char *pszKey;
+} aJsonKeys[] = 
+{
+    { CH_FREQUENCY, "frequency" }, { CH_ENERGY_OUT, "energy_out" }, { CH_ENERGY_IN, "energy_in" },
+    { CH_VOLTAGE_1, "u_1" }, { CH_CURRENT_1, "i_1" }, { CH_POWER_1, "p_1" }, { CH_APPARENT_POWER_1, "ap_1" }, { CH_REACTIVE_POWER_1, "rp_1" },
+    { CH_VOLTAGE_2, "u_2" }, { CH_CURRENT_2, "i_2" }, { CH_POWER_2, "p_2" }, { CH_APPARENT_POWER_2, "ap_2" }, { CH_REACTIVE_POWER_2, "rp_2" },
+    { CH_VOLTAGE_3, "u_3" }, { CH_CURRENT_3, "i_3" }, { CH_POWER_3, "p_3" }, { CH_APPARENT_POWER_3, "ap_3" }, { CH_REACTIVE_POWER_3, "rp_3" },
+};
+
+/**
+ * @brief values of the last published cycle and communication status of a meter (GET /api/meter)
+ * 
+ * @param pM        meter, NULL: not connected
+ * @param root      JSON object to fill
+ * @param ulMask    channels to add, bit by eChannel, e.g. from GetChangedSince(): only changed values
+ */
+void MeterToJson(ModBusMeter *pM, JsonObject root, uint32_t ulMask)
+{
+    if (!pM)
+    {
+        root[F("connected")] = false;
+        return;
+    }
+
+    mb_snapshot_t snap;
+    pM->GetSnapshot(snap);
+
+    root[F("connected")] = pM->isConnected();
+    root[F("health")] = pM->GetHealthText();
+
+    for (unsigned int i=0; i<sizeof(aJsonKeys)/sizeof(aJsonKeys[0]); i++)
+    {
+        if (ulMask & (1UL << aJsonKeys[i].ch))
+        {
+#ifdef MB_FIXED_CHANNELS
+            // decimal text from the scaled integer, no float formatting
+            char szValue[16];
+            FormatValue(szValue, sizeof(szValue), aJsonKeys[i].ch, snap.avChannel[aJsonKeys[i].ch]);
+            root[aJsonKeys[i].pszKey] = serialized(String(szValue));
+#else
+            root[aJsonKeys[i].pszKey] = snap.avChannel[aJsonKeys[i].ch];
+#endif
+        }
+    }
+    const mb_derived_t &d = snap.derived;
+    root[F("p_sum")] = d.fPowerTotal;
+    root[F("ap_sum")] = d.fApparentTotal;
+    root[F("rp_sum")] = d.fReactiveTotal;
+    root[F("pf_1")] = d.afPowerFactor[0];
+    root[F("pf_2")] = d.afPowerFactor[1];
+    root[F("pf_3")] = d.afPowerFactor[2];
+    root[F("pf")] = d.fPowerFactor;
+    root[F("imbalance")] = d.fImbalance;
+    if (d.fEnergyValid)
+    {
+        root[F("energy_in_mwh")] = (long long)d.llEnergyIn;
+        root[F("energy_out_mwh")] = (long long)d.llEnergyOut;
+        root[F("energy_corr")] = (long)d.lCorrection;
+    }
+    root[F("changed")] = (unsigned long)snap.ulChanged;
+    root[F("cycle")] = (unsigned long)snap.ulCycle;
+    root[F("age")] = (unsigned long)(millis() - snap.ulTime);
+    int iBlock = pM->GetAlignBlock();
+    if (iBlock >= 0)
+        root[F("t_us")] = (long long)snap.allBlockTime[iBlock];    // acquisition of the power values
+    root[F("skew_us")] = (unsigned long)snap.ulSkew;
+    root[F("cycles")] = (unsigned long)pM->GetCycles();
+    root[F("ErrCnt")] = (unsigned long)pM->GetErrCnt();
+    root[F("DeviceAddr")] = (unsigned long)pM->GetDeviceAddr();
+    root[F("DeviceType")] = pM->GetDeviceTypeText();
+    if (pM->GetFWVersion())
+        root[F("FWVersion")] = (unsigned long)pM->GetFWVersion();
+    root[F("rtt_avg")] = pM->GetRttAvg();
+    root[F("rtt_p99")] = pM->GetRttP99();
+    root[F("rtt_max")] = pM->GetRttMax();
+    root[F("timeout")] = (unsigned long)pM->GetTimeout();
+}
@@ -0,0 +1,300 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	metermap.cpp
+*
+* @brief:	register maps and read plans of the supported Modbus meters
+* @author:	Dierk Arp
+* @date:	20261016 09:12:40
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "MeterMap.h"
+#include "ModbusRegister.h"
+
+//
+// register maps: one entry per register value, sorted by function code and address
+// adding a meter model: add a map, static_assert it and fill in a line in g_MeterMaps[]
+//
+#define SDM_FLOAT(addr, ch, poll)           { READ_INPUT_REGISTER, addr, 2, DT_FLOAT, 1.0f, WO_HIGH_FIRST, ch, poll }
+#define FINDER_U16(addr, scale, ch, poll)   { READ_HOLD_REGISTER, addr, 1, DT_U16, scale, WO_HIGH_FIRST, ch, poll }
+#define FINDER_U32(addr, scale, ch, poll)   { READ_HOLD_REGISTER, addr, 2, DT_U32, scale, WO_HIGH_FIRST, ch, poll }
+
+// 3 phase meters (SDM 630)
+static constexpr mb_regdesc_t SDM630_MAP[] = 
+{
+    SDM_FLOAT(SDM_PHASE_1_VOLTAGE,          CH_VOLTAGE_1,          PC_NORMAL),
+    SDM_FLOAT(SDM_PHASE_2_VOLTAGE,          CH_VOLTAGE_2,          PC_NORMAL),
+    SDM_FLOAT(SDM_PHASE_3_VOLTAGE,          CH_VOLTAGE_3,          PC_NORMAL),
+    SDM_FLOAT(SDM_PHASE_1_CURRENT,          CH_CURRENT_1,          PC_FAST),
+    SDM_FLOAT(SDM_PHASE_2_CURRENT,          CH_CURRENT_2,          PC_FAST),
+    SDM_FLOAT(SDM_PHASE_3_CURRENT,          CH_CURRENT_3,          PC_FAST),
+    SDM_FLOAT(SDM_PHASE_1_POWER,            CH_POWER_1,            PC_FAST),
+    SDM_FLOAT(SDM_PHASE_2_POWER,            CH_POWER_2,            PC_FAST),
+    SDM_FLOAT(SDM_PHASE_3_POWER,            CH_POWER_3,            PC_FAST),
+    SDM_FLOAT(SDM_PHASE_1_APPARENT_POWER,   CH_APPARENT_POWER_1,   PC_FAST),
+    SDM_FLOAT(SDM_PHASE_2_APPARENT_POWER,   CH_APPARENT_POWER_2,   PC_FAST),
+    SDM_FLOAT(SDM_PHASE_3_APPARENT_POWER,   CH_APPARENT_POWER_3,   PC_FAST),
+    SDM_FLOAT(SDM_PHASE_1_REACTIVE_POWER,   CH_REACTIVE_POWER_1,   PC_FAST),
+    SDM_FLOAT(SDM_PHASE_2_REACTIVE_POWER,   CH_REACTIVE_POWER_2,   PC_FAST),
+    SDM_FLOAT(SDM_PHASE_3_REACTIVE_POWER,   CH_REACTIVE_POWER_3,   PC_FAST),
+    SDM_FLOAT(SDM_FREQUENCY,                CH_FREQUENCY,          PC_NORMAL),
+    SDM_FLOAT(SDM_IMPORT_ACTIVE_ENERGY,     CH_ENERGY_IN,          PC_SLOW),
+    SDM_FLOAT(SDM_EXPORT_ACTIVE_ENERGY,     CH_ENERGY_OUT,         PC_SLOW),
+};
+
+// single phase meters (SDM 230, 220, 120, 72D): only phase 1
+static constexpr mb_regdesc_t SDM1P_MAP[] = 
+{
+    SDM_FLOAT(SDM_PHASE_1_VOLTAGE,          CH_VOLTAGE_1,          PC_NORMAL),
+    SDM_FLOAT(SDM_PHASE_1_CURRENT,          CH_CURRENT_1,          PC_FAST),
+    SDM_FLOAT(SDM_PHASE_1_POWER,            CH_POWER_1,            PC_FAST),
+    SDM_FLOAT(SDM_PHASE_1_APPARENT_POWER,   CH_APPARENT_POWER_1,   PC_FAST),
+    SDM_FLOAT(SDM_PHASE_1_REACTIVE_POWER,   CH_REACTIVE_POWER_1,   PC_FAST),
+    SDM_FLOAT(SDM_FREQUENCY,                CH_FREQUENCY,          PC_NORMAL),
+    SDM_FLOAT(SDM_IMPORT_ACTIVE_ENERGY,     CH_ENERGY_IN,          PC_SLOW),
+    SDM_FLOAT(SDM_EXPORT_ACTIVE_ENERGY,     CH_ENERGY_OUT,         PC_SLOW),
+};
+
+// Finder 7E.23: fixed point holding registers
+static constexpr mb_regdesc_t FINDER_MAP[] = 
+{
+    FINDER_U32(FINDER_IMPORT_ACTIVE_ENERGY,     0.01f,  CH_ENERGY_IN,          PC_SLOW),
+    FINDER_U32(FINDER_EXPORT_ACTIVE_ENERGY,     0.01f,  CH_ENERGY_OUT,         PC_SLOW),
+    FINDER_U16(FINDER_PHASE_1_VOLTAGE,          1.0f,   CH_VOLTAGE_1,          PC_NORMAL),
+    FINDER_U16(FINDER_PHASE_1_CURRENT,          0.1f,   CH_CURRENT_1,          PC_FAST),
+    FINDER_U16(FINDER_PHASE_1_POWER,            10.0f,  CH_POWER_1,            PC_FAST),        // 0.01 kW in W
+    FINDER_U16(FINDER_PHASE_1_REACTIVE_POWER,   10.0f,  CH_REACTIVE_POWER_1,   PC_FAST),        // 0.01 kVAr in VAr
+};
+
+static_assert(IsMapSorted(SDM630_MAP), "SDM630 register map not sorted");
+static_assert(IsMapSorted(SDM1P_MAP), "SDM single phase register map not sorted");
+static_assert(IsMapSorted(FINDER_MAP), "Finder register map not sorted");
+
+//
+// read plans, generated at compile time
+//
+static constexpr auto SDM630_PLAN = PlanBlocks(SDM630_MAP);
+static constexpr auto SDM1P_PLAN = PlanBlocks(SDM1P_MAP, 0);       // phase 2/3 registers in the gaps are not implemented
+static constexpr auto FINDER_PLAN = PlanBlocks(FINDER_MAP);
+
+//
+// channel layouts, generated at compile time
+//
+static constexpr auto SDM630_CHANNELS = ChannelLayout(SDM630_MAP, sizeof(SDM630_MAP)/sizeof(SDM630_MAP[0]));
+static constexpr auto SDM1P_CHANNELS = ChannelLayout(SDM1P_MAP, sizeof(SDM1P_MAP)/sizeof(SDM1P_MAP[0]));
+static constexpr auto FINDER_CHANNELS = ChannelLayout(FINDER_MAP, sizeof(FINDER_MAP)/sizeof(FINDER_MAP[0]));
+static constexpr auto NO_CHANNELS = ChannelLayout(NULL, 0);
+
+static_assert(SDM630_CHANNELS.uNChannels == CH_COUNT, "SDM630 should provide all channels");
+static_assert(SDM1P_CHANNELS.uNChannels == 8, "SDM single phase should provide 8 channels");
+
+static_assert(SDM630_PLAN.uNBlocks == 4, "SDM630 should read 4 blocks");
+static_assert(SDM630_PLAN.uNBlocks <= MB_MAX_BLOCKS, "SDM630: too many blocks");
+static_assert(SDM1P_PLAN.uNBlocks <= MB_MAX_BLOCKS, "SDM single phase: too many blocks");
+static_assert(FINDER_PLAN.uNBlocks <= MB_MAX_BLOCKS, "Finder: too many blocks");
+
+#define MAP_ENTRY(name, map, plan, channels, probefc, probeaddr, probewords) \
+    { name, map, sizeof(map)/sizeof(map[0]), &channels, plan.aBlocks, plan.uNBlocks, probefc, probeaddr, probewords }
+#define MAP_EMPTY(name, probefc, probeaddr, probewords) \
+    { name, NULL, 0, &NO_CHANNELS, NULL, 0, probefc, probeaddr, probewords }
+
+/// maps indexed by eMeterType
+static const mb_metermap_t g_MeterMaps[MT_UNKNOWN+1] = 
+{
+    MAP_ENTRY("SDM630", SDM630_MAP, SDM630_PLAN, SDM630_CHANNELS, READ_INPUT_REGISTER, SDM_PHASE_1_VOLTAGE, 2),       // MT_SDM630
+    MAP_ENTRY("SDM230", SDM1P_MAP, SDM1P_PLAN, SDM1P_CHANNELS, READ_INPUT_REGISTER, SDM_PHASE_1_VOLTAGE, 2),         // MT_SDM230
+    MAP_ENTRY("SDM220", SDM1P_MAP, SDM1P_PLAN, SDM1P_CHANNELS, READ_INPUT_REGISTER, SDM_PHASE_1_VOLTAGE, 2),         // MT_SDM220
+    MAP_ENTRY("SDM120", SDM1P_MAP, SDM1P_PLAN, SDM1P_CHANNELS, READ_INPUT_REGISTER, SDM_PHASE_1_VOLTAGE, 2),         // MT_SDM120
+    MAP_ENTRY("SDM72D", SDM1P_MAP, SDM1P_PLAN, SDM1P_CHANNELS, READ_INPUT_REGISTER, SDM_PHASE_1_VOLTAGE, 2),         // MT_SDM72D
+    MAP_EMPTY("DDM", READ_INPUT_REGISTER, DDM_PHASE_1_VOLTAGE, 2),                                   // MT_DDM: not yet supported
+    MAP_ENTRY("FINDER", FINDER_MAP, FINDER_PLAN, FINDER_CHANNELS, READ_HOLD_REGISTER, FINDER_FIRMWARE_VERSION, 1),    // MT_FINDER: probe firmware register
+    MAP_EMPTY("unknown", READ_INPUT_REGISTER, 0, 0),                                                 // MT_UNKNOWN
+};
+
+/**
+ * @brief get register map and read plan of a meter type
+ * 
+ * @param mt    meter type
+ * @return const mb_metermap_t*  map, never NULL (MT_UNKNOWN for invalid types)
+ */
+const mb_metermap_t *GetMeterMap(eMeterType mt)
+{
+    if ((mt < MT_SDM630) || (mt > MT_UNKNOWN))
+        mt = MT_UNKNOWN;
+    return &g_MeterMaps[mt];
+}
+
+/**
+ * @brief meter type by its name (case insensitive)
+ * 
+ * @param pszName   type name, e.g. "SDM630"
+ * @return eMeterType  type, MT_UNKNOWN if no match
+ */
+eMeterType GetMeterType(const char *pszName)
+{
+    if (pszName)
+    {
+        for (int mt=MT_SDM630; mt<MT_UNKNOWN; mt++)
+        {
+            if (strcasecmp(pszName, g_MeterMaps[mt].pszName) == 0)
+                return (eMeterType)mt;
+        }
+    }
+    return MT_UNKNOWN;
+}
+
+//
+// fingerprints for bus discovery: a register only the meter type provides,
+// checked in this order, the first readable register decides the type
+//
+static const mb_fingerprint_t g_Fingerprints[] = 
+{
+    { MT_SDM630, READ_INPUT_REGISTER, SDM_LINE_1_TO_LINE_2_VOLTS, 2 },                  // only 3 phase SDM
+    { MT_SDM230, READ_INPUT_REGISTER, SDM_CURRENT_SYSTEM_POSITIVE_POWER_DEMAND, 2 },
+    { MT_SDM72D, READ_INPUT_REGISTER, SDM_IMPORT_POWER, 2 },
+    { MT_SDM220, READ_INPUT_REGISTER, SDM_IMPORT_REACTIVE_ENERGY, 2 },                  // SDM220 and SDM120 provide the same registers
+    { MT_FINDER, READ_HOLD_REGISTER, FINDER_FIRMWARE_VERSION, 1 },
+    { MT_DDM, READ_INPUT_REGISTER, DDM_FREQUENCY, 2 },
+};
+
+/**
+ * @brief fingerprints to identify meter types in a bus discovery, in order of checking
+ * 
+ * @param iN    [out] # of fingerprints
+ */
+const mb_fingerprint_t *GetFingerprints(int &iN)
+{
+    iN = sizeof(g_Fingerprints) / sizeof(g_Fingerprints[0]);
+    return g_Fingerprints;
+}
+
+//
+// deadbands by eChannel: smaller changes are not reported as changed
+//
+static const mb_deadband_t g_Deadbands[CH_COUNT] = 
+{
+    { 0.5f,   0.0f  },      // CH_VOLTAGE_1         [V]
+    { 0.5f,   0.0f  },      // CH_VOLTAGE_2
+    { 0.5f,   0.0f  },      // CH_VOLTAGE_3
+    { 0.02f,  0.01f },      // CH_CURRENT_1         [A]
+    { 0.02f,  0.01f },      // CH_CURRENT_2
+    { 0.02f,  0.01f },      // CH_CURRENT_3
+    { 5.0f,   0.01f },      // CH_POWER_1           [W]
+    { 5.0f,   0.01f },      // CH_POWER_2
+    { 5.0f,   0.01f },      // CH_POWER_3
+    { 5.0f,   0.01f },      // CH_APPARENT_POWER_1  [VA]
+    { 5.0f,   0.01f },      // CH_APPARENT_POWER_2
+    { 5.0f,   0.01f },      // CH_APPARENT_POWER_3
+    { 5.0f,   0.01f },      // CH_REACTIVE_POWER_1  [VAr]
+    { 5.0f,   0.01f },      // CH_REACTIVE_POWER_2
+    { 5.0f,   0.01f },      // CH_REACTIVE_POWER_3
+    { 0.02f,  0.0f  },      // CH_FREQUENCY         [Hz]
+    { 0.005f, 0.0f  },      // CH_ENERGY_IN         [kWh]: each step of the counter
+    { 0.005f, 0.0f  },      // CH_ENERGY_OUT        [kWh]
+};
+
+/**
+ * @brief deadband of a channel
+ * 
+ * @param ch    channel
+ * @return const mb_deadband_t*  deadband, never NULL (no deadband for invalid channels)
+ */
+const mb_deadband_t *GetDeadband(eChannel ch)
+{
+    static const mb_deadband_t NoDeadband = { 0.0f, 0.0f };
+
+    if ((ch < 0) || (ch >= CH_COUNT))
+        return &NoDeadband;
+    return &g_Deadbands[ch];
+}
+
+//
+// fixed point units by eChannel (MB_FIXED_CHANNELS)
+//
+static const mb_fixfmt_t g_FixedFormats[CH_COUNT] = 
+{
+    { 1000, 3 },            // CH_VOLTAGE_1         [mV]
+    { 1000, 3 },            // CH_VOLTAGE_2
+    { 1000, 3 },            // CH_VOLTAGE_3
+    { 1000, 3 },            // CH_CURRENT_1         [mA]
+    { 1000, 3 },            // CH_CURRENT_2
+    { 1000, 3 },            // CH_CURRENT_3
+    { 1000, 3 },            // CH_POWER_1           [mW]
+    { 1000, 3 },            // CH_POWER_2
+    { 1000, 3 },            // CH_POWER_3
+    { 1000, 3 },            // CH_APPARENT_POWER_1  [mVA]
+    { 1000, 3 },            // CH_APPARENT_POWER_2
+    { 1000, 3 },            // CH_APPARENT_POWER_3
+    { 1000, 3 },            // CH_REACTIVE_POWER_1  [mVAr]
+    { 1000, 3 },            // CH_REACTIVE_POWER_2
+    { 1000, 3 },            // CH_REACTIVE_POWER_3
+    { 1000, 3 },            // CH_FREQUENCY         [mHz]
+    { 1000, 3 },            // CH_ENERGY_IN         [Wh]
+    { 1000, 3 },            // CH_ENERGY_OUT        [Wh]
+};
+
+/**
+ * @brief fixed point unit of a channel
+ * 
+ * @param ch    channel
+ * @return const mb_fixfmt_t*  format, never NULL (1:1 for invalid channels)
+ */
+const mb_fixfmt_t *GetFixedFormat(eChannel ch)
+{
+    static const mb_fixfmt_t NoScale = { 1, 0 };
+
+    if ((ch < 0) || (ch >= CH_COUNT))
+        return &NoScale;
+    return &g_FixedFormats[ch];
+}
+
+/**
+ * @brief channel value as decimal text in the unit of the channel, e.g. "230.125" V
+ *        with MB_FIXED_CHANNELS integer formatting only
+ * 
+ * @param pszBuf    buffer
+ * @param uSize     size of buffer
+ * @param ch        channel
+ * @param v         value
+ * @return int      length of text
+ */
+int FormatValue(char *pszBuf, size_t uSize, eChannel ch, mb_value_t v)
+{
+#ifdef MB_FIXED_CHANNELS
+    const mb_fixfmt_t *pF = GetFixedFormat(ch);
+    if (pF->uDecimals == 0)
+        return snprintf(pszBuf, uSize, "%ld", (long)v);
+    long lAbs = labs((long)v);
+    return snprintf(pszBuf, uSize, "%s%ld.%0*ld", (v < 0) ? "-" : "", lAbs / pF->lScale, pF->uDecimals, lAbs % pF->lScale);
+#else
+    return snprintf(pszBuf, uSize, "%g", v);
+#endif
+}
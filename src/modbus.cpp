@@ -35,28 +35,185 @@
 static const char TAG[] = __FILE__;
 
 #include "globals.h"
+#include <new>
+#include <esp_timer.h>
 
 #include "modbus.h"
 #include "ModbusRegister.h"
 #include "logging.h"
 
 
-#define MAX_METERS  (4)
-ModBusMeter ModMeters[MAX_METERS];
-int iNMeters = 0;
+static ModBusMeter *ModMeters = NULL;   // meters on bus, allocated by StartModBus
+static int iNMeters = 0;
+static mb_value_t *pvChannelStore = NULL;   // channel values of all meters, packed meter by meter
+static mb_value_t *pvPublicStore = NULL;    // published copy of the channel store
+static mb_value_t *pvRefStore = NULL;       // last reported values of the channel store, change detection
+static uint8_t *pShadowStore = NULL;    // shadow register images of all meters
+static int iNChannelValues = 0;
+static uint32_t ulBaudrate = 9600;
 
 //pins for Serial2 => RX pin 35, TX pin 13, pin 17: RTS (Rx/Tx switch)
 ModbusClientRTU MB(Serial2, 17); 
 
-#define MODBUSCYCLE          (10)       // read meter data every x s
+#define MB_MAX_INFLIGHT      (1)        // requests handed to eModbus at a time, the scheduler decides the order
+#define MB_QUEUE_CONTROL     (8)        // depth limits of request classes
+#define MB_QUEUE_POLL        (16)
+#define MB_READ_REQ_BYTES    (8)        // read request frame: id, fc, addr, words, CRC
+#define MB_UTIL_WINDOW       (10000)    // window of bus utilization [ms]
+#define MB_TURNAROUND_MS     (20)       // typical response delay of a meter, for bus load estimation
+
+// adaptive response timeouts
+#define MB_TIMEOUT_INIT      (500)      // timeout until response delay of a device is known [ms]
+#define MB_TIMEOUT_MIN       (20)       // lower bound of adaptive timeout [ms]
+#define MB_TIMEOUT_MAX       (2000)     // upper bound of adaptive timeout [ms]
+#define MB_TIMEOUT_FACTOR    (3)        // timeout = factor * p99 of response delay
+#define MB_RTT_MIN_SAMPLES   (8)        // samples needed before timeout is adapted
+
+// device health
+#define MB_RETRY_BUDGET      (3)        // transport errors in a row until a meter is offline
+#define MB_BACKOFF_MIN       (1000)     // first reconnect delay [ms]
+#define MB_BACKOFF_MAX       (300000L)  // max. reconnect delay [ms]
+#define MB_OFFLINE_SHARE     (5)        // max. share of bus time for offline meters [%]
+#define MB_OFFLINE_BUCKET    (3000)     // max. saved bus time for offline meters [ms]
+
+// bus discovery
+#define MB_CTX_DISCOVERY     (0xff)     // request context of discovery requests
+#define MB_DISC_TIMEOUT      (40)       // response timeout of sweep probes [ms]
+#define MB_DISC_INFLIGHT     (4)        // sweep probes queued in eModbus at a time
+#define MB_DISC_FC           (READ_INPUT_REGISTER)  // sweep probe: any response or exception is a device
+#define MB_DISC_REG          (0)
+#define MB_DISC_WORDS        (2)
+
+// TCP to RTU bridge
+#define MB_CTX_BRIDGE        (0xfe)     // request context of bridged requests
+#define MB_BRIDGE_JOBS       (8)        // bus transactions for TCP clients
+#define MB_BRIDGE_WAITERS    (16)       // max. clients waiting for one transaction
+#define MB_BRIDGE_CLIENTS    (8)        // clients tracked for fairness
+#define MB_BRIDGE_PER_CLIENT (2)        // queued transactions per client, more: server busy
+#define MB_BRIDGE_QUANTUM    (100)      // fair share: bus time charged per transaction of a client [ms]
+
+// register writes
+#define MB_CTX_WRITE         (0xfd)     // request context of write requests
+#define MB_WRITE_JOBS        (4)        // write jobs running or holding their result
+#define MB_WRITE_MAX_RUNS    (8)        // transactions of one job: runs of adjacent registers
+#define MB_WRITE_RUN_WORDS   (123)      // max. registers of one FC16 request
+#define MB_WRITE_DEADLINE    (5000)     // max. wait of a write step for the bus [ms]
 
 // eModBus Token usage:
-// token & 0xffff   : lower 16bit for register/command id
-// token >> 16      :  bits 16..18: for device type
-// token >> 24      :  bit 24,25: for device idx
-// some special tokens..
-#define TOK_START   (0x4711)          // start identifier of a cycle
-#define TOK_FINAL   (0x10000000L)     // last command of a cycle
+// token & 0xff     : slot in request context table
+// token >> 8       : generation of slot, a late response of a reused slot is dropped
+#define MB_REQ_SLOTS    (8)             // max. requests in eModbus queue
+#define TOK_SLOT(t)     ((t) & 0xff)
+#define TOK_GEN(t)      (((t) >> 8) & 0xff)
+
+// scheduler access control: loop() and eModbus task
+static SemaphoreHandle_t MBaccess = NULL;
+#define MB_MUTEX_LOCK()     (xSemaphoreTake(MBaccess, portMAX_DELAY) == pdTRUE)
+#define MB_MUTEX_UNLOCK()   (xSemaphoreGive(MBaccess))
+
+static MBQueue MBQ;                 // requests waiting for eModbus
+static int iInFlight = 0;           // requests queued in eModbus
+static int iDiscInFlight = 0;       // discovery requests queued in eModbus
+static mb_reqctx_t aReqCtx[MB_REQ_SLOTS];   // request context table, indexed by token
+static uint8_t auReqFree[MB_REQ_SLOTS];     // stack of free slots
+static int iReqFree = 0;                    // # of free slots
+static uint32_t ulCharUs = 1042;    // time of one character on the bus [us], 9600 baud
+static int32_t lOfflineBudget = MB_OFFLINE_BUCKET;  // bus time offline meters may use [ms]
+static uint32_t ulOfflineRefill = 0;                // last refill of offline budget [ms]
+static uint32_t ulBusLoad = 0;      // estimated bus load of poll plan [%]
+static MBMetrics BusMetrics;        // request counters of all requests on bus
+static MBCapture Capture;           // raw frames for debugging
+static uint32_t ulUtilStart = 0;    // start of utilization window [ms]
+static uint64_t ullUtilBusyUs = 0;  // busy time of bus at start of window [us]
+static uint32_t ulLineFree = 0;     // end of last transaction on the bus [us]
+static uint32_t ulBusUtil = 0;      // measured bus utilization of last window [%]
+
+// aligned polling: power blocks of all meters due on a common time grid, spread of each round measured
+static bool fAlignPolling = false;
+static uint32_t ulAlignEpoch = 0;   // origin of the grid [ms]
+static int64_t llRoundFirst = 0;    // first power block acquisition of current round [us]
+static int64_t llRoundLast = 0;     // last power block acquisition of current round [us]
+static int iRoundReads = 0;         // power blocks read in current round
+static mb_alignstats_t AlignStats;
+
+/// state of bus discovery
+enum eDiscoveryState
+{
+      DS_IDLE,              // no discovery
+      DS_SWEEP,             // probe all addresses for responders
+      DS_FINGERPRINT,       // identify meter type of responders
+      DS_DONE               // finished, meters to be set up
+};
+
+static eDiscoveryState eDiscState = DS_IDLE;
+static int iDiscAddr = 0;                   // next address to probe or responder to identify
+static int iDiscTest = 0;                   // fingerprint checked at responder
+static uint32_t aulDiscAlive[8];            // responders of sweep, bit per address
+static int iDiscFound = 0;                  // # of identified meters
+static eMeterType aeDiscType[MAX_METERS];   // identified meters
+static uint16_t auDiscAddr[MAX_METERS];
+static mb_discovery_cb_t pfnDiscDone = NULL;
+
+/// state of a bridged bus transaction
+enum eBridgeState
+{
+      BJ_FREE,
+      BJ_QUEUED,            // waiting for the bus, range may still grow
+      BJ_INFLIGHT,          // handed to eModbus
+      BJ_DONE               // response or error available for waiters
+};
+
+/// bus transaction for TCP clients: identical and overlapping reads share one transaction
+typedef struct
+{
+    eBridgeState eState;
+    uint8_t uServer;            // device address
+    uint8_t uFC;                // function code
+    uint16_t uAddr;             // registers read on bus, covers the reads of all waiters
+    uint16_t uWords;
+    void *pClient;              // client that queued the transaction
+    int iWaiters;               // # of clients waiting for the response
+    Error err;                  // result
+    SemaphoreHandle_t hDone;    // given once per waiter, when done
+    uint8_t abData[2 * MB_MAX_BLOCK_WORDS];
+} mb_bridgejob_t;
+
+/// client of the bridge, transactions are ordered by virtual time: each one is charged MB_BRIDGE_QUANTUM
+typedef struct
+{
+    void *pClient;
+    uint32_t ulVTime;           // virtual time of last transaction of client [ms]
+} mb_bridgeclient_t;
+
+static mb_bridgejob_t aBridge[MB_BRIDGE_JOBS];
+static mb_bridgeclient_t aBridgeClient[MB_BRIDGE_CLIENTS];
+
+/// adjacent registers of a write job, written with one FC06/FC16 request and read back with one FC03 request
+typedef struct
+{
+    uint16_t uAddr;             // first register
+    uint8_t uFirst;             // index of first value
+    uint8_t uWords;             // # of registers
+} mb_writerun_t;
+
+/// write job: its runs are written one after the other at PRIO_CONTROL, each one optionally read back
+typedef struct
+{
+    eWriteState eState;
+    uint8_t uGen;               // generation, part of the job id
+    uint8_t uServer;            // device address
+    bool fVerify;               // read back each run
+    bool fReading;              // current step is the read back of run uRun
+    uint8_t uNRuns;             // # of runs
+    uint8_t uRun;               // current run
+    Error err;                  // result
+    uint16_t uFailAddr;         // register of failure or mismatch
+    uint32_t ulDone;            // time of result [ms]
+    mb_writerun_t aRun[MB_WRITE_MAX_RUNS];
+    uint16_t auValue[MB_WRITE_MAX_REGS];    // values sorted by register
+} mb_writejob_t;
+
+static mb_writejob_t aWrite[MB_WRITE_JOBS];
 
 
 //
@@ -65,18 +222,127 @@ ModbusClientRTU MB(Serial2, 17);
 ModBusMeter::ModBusMeter()
 {
     fConnected = false; 
+    eHealth = MH_OFFLINE;
+    iRetryBudget = 0;
+    iBackoff = 0;
     iCycles = 0;
     iErrCnt = 0; 
+    iOverruns = 0;
+    ulRttN = 0;
+    fRttAvg = 0.0;
+    fRttP99 = 0.0;
+    ulRttMax = 0;
+    pvChannel = NULL;
+    pvPublic = NULL;
+    ulSeq = 0;
+    ulPublicCycle = 0;
+    ulPublicTime = 0;
+    pvRef = NULL;
+    ulChanged = 0;
+    ulPublicChanged = 0;
+    memset(aulChangeCycle, 0, sizeof(aulChangeCycle));
+    memset(&PublicDerived, 0, sizeof(PublicDerived));
+    ulPublicSkew = 0;
+    pShadow = NULL;
+    ulShadowSeq = 0;
+    ulShadowMaxAge = 0;
+    SetMeter(MT_UNKNOWN, 0);
 }
 
 ModBusMeter::~ModBusMeter()
 {
 }
 
-void ModBusMeter::SetMeter(eMeterType mt, int iDevAddr)
+void ModBusMeter::SetMeter(eMeterType mt, int iDevAddr, int iIdx)
 {
     eDeviceType = mt;
     iDeviceAddr = iDevAddr;
+    iMeterIdx = iIdx;
+    uFWVersion = 0;
+    pMap = GetMeterMap(mt);
+
+    // a cycle is complete with the last block of the fastest poll class
+    uCycleBlock = 0;
+    for (int i=1; i<pMap->uNBlocks; i++)
+    {
+        if (pMap->pBlocks[i].ePoll <= pMap->pBlocks[uCycleBlock].ePoll)
+            uCycleBlock = i;
+    }
+    ulProbeDue = millis();
+    memset(aulDue, 0, sizeof(aulDue));
+
+    // shadow image: all block reads one after the other
+    uShadowWords = 0;
+    for (int i=0; i<pMap->uNBlocks; i++)
+    {
+        auShadowOff[i] = uShadowWords;
+        uShadowWords += pMap->pBlocks[i].uWords;
+    }
+    memset(aulShadowTime, 0, sizeof(aulShadowTime));
+    memset(allBlockTime, 0, sizeof(allBlockTime));
+    memset(allPublicBlockTime, 0, sizeof(allPublicBlockTime));
+    iAlignBlock = GetChannelBlock(CH_POWER_1);
+
+    // request frames of the poll plan, connect request last
+    for (int i=0; i<pMap->uNBlocks; i++)
+        CompileRequest(aReqFrame[i], pMap->pBlocks[i].uFC, pMap->pBlocks[i].uStart, pMap->pBlocks[i].uWords);
+    aReqFrame[pMap->uNBlocks].Msg = ModbusMessage();
+    if (pMap->uProbeWords)
+        CompileRequest(aReqFrame[pMap->uNBlocks], pMap->uProbeFC, pMap->uProbeAddr, pMap->uProbeWords);
+}
+
+/**
+ * @brief block read that provides a channel
+ * 
+ * @param ch        channel
+ * @return int      block index, -1: channel not read by meter type
+ */
+int ModBusMeter::GetChannelBlock(eChannel ch)
+{
+    for (int i=0; i<pMap->uNBlocks; i++)
+    {
+        const mb_block_t *pB = &pMap->pBlocks[i];
+        for (int r=pB->uFirstReg; r<pB->uFirstReg + pB->uNRegs; r++)
+        {
+            if (pMap->pRegs[r].eCh == ch)
+                return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief build a read request of the device once: message for eModbus and RTU frame with CRC
+ */
+void ModBusMeter::CompileRequest(mb_reqframe_t &r, uint8_t uFC, uint16_t uAddr, uint16_t uWords)
+{
+    uint8_t *p = r.abFrame;
+
+    p[0] = iDeviceAddr;
+    p[1] = uFC;
+    p[2] = uAddr >> 8;
+    p[3] = uAddr & 0xff;
+    p[4] = uWords >> 8;
+    p[5] = uWords & 0xff;
+    uint16_t uCRC = RTUutils::calcCRC(p, 6);
+    p[6] = uCRC & 0xff;
+    p[7] = uCRC >> 8;
+
+    r.Msg = ModbusMessage();
+    r.Msg.add(p, 6);
+}
+
+/**
+ * @brief precompiled request of a block read
+ * 
+ * @param iBlock    block index or MB_BLOCK_PROBE
+ * @return const mb_reqframe_t* request, NULL: no such block
+ */
+const mb_reqframe_t *ModBusMeter::GetRequestFrame(int iBlock)
+{
+    if (iBlock == MB_BLOCK_PROBE)
+        return pMap->uProbeWords ? &aReqFrame[pMap->uNBlocks] : NULL;
+    return ((iBlock >= 0) && (iBlock < pMap->uNBlocks)) ? &aReqFrame[iBlock] : NULL;
 }
 
 //
@@ -84,33 +350,7 @@ void ModBusMeter::SetMeter(eMeterType mt, int iDevAddr)
 //
 const char *ModBusMeter::MeterType2Text(eMeterType mt)
 {
-    switch (mt)
-    {
-        case MT_SDM630:
-            return "SDM630";
-            break;
-        case MT_SDM230:
-            return "SDM230";
-            break;
-        case MT_SDM220:
-            return "SDM220";
-            break;
-        case MT_SDM120:
-            return "SDM120";
-            break;
-        case MT_SDM72D:
-            return "SDM72D";
-            break;
-        case MT_DDM:
-            return "DDM";
-            break;
-        case MT_FINDER:
-            return "FINDER";
-            break;
-        default:
-            return "unknown";
-            break;
-    }
+    return GetMeterMap(mt)->pszName;
 }
 
 eMeterType ModBusMeter::Text2MeterType(const String&  sDevText)
@@ -151,161 +391,164 @@ eMeterType ModBusMeter::Text2MeterType(const String&  sDevText)
     return dt;
 }
 
-float ModBusMeter::toFloat(ModbusMessage response)
+//
+// big endian values of a response: unaligned load and byte swap, no copy of the message
+//
+static inline uint16_t GetBE16(const uint8_t *p)
 {
-    float fTmp = NAN;
-
-    ((uint8_t*)&fTmp)[3]= response[3];
-    ((uint8_t*)&fTmp)[2]= response[4];
-    ((uint8_t*)&fTmp)[1]= response[5];
-    ((uint8_t*)&fTmp)[0]= response[6];
-
-    if (!isnan(fTmp))
-    {
-        debugV("Modbus float: %f", fTmp);
-        return fTmp;
-    }
-    else
-        return 0.0;
+    uint16_t uTmp;
+    memcpy(&uTmp, p, sizeof(uTmp));
+    return __builtin_bswap16(uTmp);
 }
 
-uint16_t ModBusMeter::toInt16(ModbusMessage response)
+static inline uint32_t GetBE32(const uint8_t *p, eWordOrder eOrder)
 {
-    uint16_t uTmp;
-  
-    ((uint8_t*)&uTmp)[1]= response[3];
-    ((uint8_t*)&uTmp)[0]= response[4];
-    return uTmp;
+    uint32_t ulTmp;
+    memcpy(&ulTmp, p, sizeof(ulTmp));
+    ulTmp = __builtin_bswap32(ulTmp);
+    return (eOrder == WO_LOW_FIRST) ? (ulTmp << 16) | (ulTmp >> 16) : ulTmp;
 }
 
-uint32_t ModBusMeter::toInt32(ModbusMessage response)
+static inline float GetBEFloat(const uint8_t *p)
 {
-    uint32_t ulTmp;
-  
-    ((uint8_t*)&ulTmp)[3]= response[3];
-    ((uint8_t*)&ulTmp)[2]= response[4];
-    ((uint8_t*)&ulTmp)[1]= response[5];
-    ((uint8_t*)&ulTmp)[0]= response[6];
-    return ulTmp;
+    uint32_t ulTmp = GetBE32(p, WO_HIGH_FIRST);
+    float fTmp;
+    memcpy(&fTmp, &ulTmp, sizeof(fTmp));
+    return isnan(fTmp) ? 0.0f : fTmp;
 }
 
 /**
- * @brief onData handler function to receive the regular responses
+ * @brief decode all registers of a block read into the working copy in one pass
  * 
- * @param response  Modbus server ID, the function code requested, the message data and length of it
- * @param token     user-supplied token to identify the causing request
+ * @param pB        block
+ * @param pWords    data of the response, big endian words from pB->uStart
+ * @return uint32_t channels decoded, bit by eChannel
  */
-void ModBusMeter::handleMeterData(ModbusMessage response, uint32_t token) 
+uint32_t ModBusMeter::DecodeBlock(const mb_block_t *pB, const uint8_t *pWords)
 {
-    debugV("Response: serverID=%d, FC=%d, Token=%08X, length=%d:", response.getServerID(), response.getFunctionCode(), token, response.size());
+    const mb_regdesc_t *pR = &pMap->pRegs[pB->uFirstReg];
+    uint32_t ulBlockChannels = 0;
 
-#if (0)
-    for (auto& byte : response) 
+    for (int i=0; i<pB->uNRegs; i++, pR++)
     {
-        debugD("%02X ", byte);
+        const uint8_t *p = pWords + 2*(pR->uAddr - pB->uStart);
+        mb_value_t vValue;
+        switch (pR->eType)
+        {
+            case DT_FLOAT:
+                vValue = FloatToValue(pR->eCh, GetBEFloat(p) * pR->fScale);
+                break;
+            case DT_U16:
+                vValue = RawToValue(pR, GetBE16(p));
+                break;
+            case DT_U32:
+                vValue = RawToValue(pR, GetBE32(p, pR->eOrder));
+                break;
+            default:
+                vValue = 0;
+                break;
+        }
+        SetChannel(pR->eCh, vValue);
+        ulBlockChannels |= 1UL << pR->eCh;
     }
-#endif
+    return ulBlockChannels;
+}
 
-    if (token == TOK_START)
-        fConnected = true;
-    else
+/**
+ * @brief store a decoded value in the working copy, mark it as changed, if it left its deadband
+ *        the deadband is kept around the last reported value, slow drifts are reported as well
+ * 
+ * @param ch        channel
+ * @param vValue    value
+ */
+void ModBusMeter::SetChannel(eChannel ch, mb_value_t vValue)
+{
+    uint8_t uSlot = pMap->pLayout->auSlot[ch];
+
+    pvChannel[uSlot] = vValue;
+    if (pvRef)
     {
-        eMeterType mt = (eMeterType) ((token >> 16) - 1);
-        if (mt == MT_FINDER)
+        const mb_deadband_t *pD = GetDeadband(ch);
+        mb_value_t vRef = pvRef[uSlot];
+        boolean fChanged = IsNoValue(vRef);
+        if (!fChanged)
         {
-            switch (token & 0xffffL)
-            {
-                case FINDER_FIRMWARE_VERSION:
-                    uFWVersion = toInt16(response);
-                    debugI("Finder firmware: %d.%d", uFWVersion/10, uFWVersion%10);
-                    break;
-                case FINDER_PHASE_1_VOLTAGE:
-                    fPhaseVoltage[0] = (float) toInt16(response);
-                    break;
-                case FINDER_PHASE_1_CURRENT:
-                    fPhaseCurrent[0] = (float)toInt16(response) * 0.1;
-                     break;
-                case FINDER_PHASE_1_POWER:
-                    fPhasePower[0] = (float)toInt16(response) * 0.01;
-                    break;
-                 case FINDER_PHASE_1_REACTIVE_POWER:
-                    fReactivePower[0] = (float)toInt16(response) * 0.01;
-                    break;
-                 case FINDER_IMPORT_ACTIVE_ENERGY:
-                    fEnergyIn = (float)toInt32(response) * 0.01;
-                    break;
-                 case FINDER_EXPORT_ACTIVE_ENERGY:
-                    fEnergyOut = (float)toInt32(response) * 0.01;
-                    break;
-            }
+            // same operations for float and fixed point values, MB_FIXED_CHANNELS compares integers
+            mb_value_t vDiff = (vValue > vRef) ? vValue - vRef : vRef - vValue;
+            fChanged = (vDiff > FloatToValue(ch, pD->fAbs)) && (vDiff > pD->fRel * ((vRef < 0) ? -vRef : vRef));
         }
-        else if (mt == MT_DDM)
+        if (fChanged)
         {
-            debugD("DDM not yet supported");
+            pvRef[uSlot] = vValue;
+            ulChanged |= 1UL << ch;
         }
-        else    // mt == all Finder
+    }
+}
+
+/**
+ * @brief onData handler function to receive the regular responses
+ * 
+ * @param pData     response: Modbus server ID, the function code requested, the message data; read only view, not copied
+ * @param uLen      length of response, 0: answer to a connect request without data
+ * @param ctx       context of the causing request
+ * @param llAcquired    acquisition time of the values [us since boot]
+ */
+void ModBusMeter::handleMeterData(const uint8_t *pData, uint16_t uLen, const mb_reqctx_t &ctx, int64_t llAcquired) 
+{
+    debugV("Response: serverID=%d, FC=%d, Block=%d, length=%d:", (uLen > 0) ? pData[0] : 0, (uLen > 1) ? pData[1] : 0, ctx.uBlock, uLen);
+
+    if (ctx.uBlock == MB_BLOCK_PROBE)
+    {
+        // connected: poll all blocks now
+        debugI("Meter %d online", iDeviceAddr);
+        fConnected = true;
+        eHealth = MH_HEALTHY;
+        iRetryBudget = MB_RETRY_BUDGET;
+        iBackoff = 0;
+        uint32_t ulNow = millis();
+        for (int i=0; i<pMap->uNBlocks; i++)
+            aulDue[i] = ulNow;
+
+        // Finder: the connect request reads the firmware register
+        if ((pMap->uProbeFC == READ_HOLD_REGISTER) && (pMap->uProbeAddr == FINDER_FIRMWARE_VERSION) && (uLen >= 5))
+        {
+            uFWVersion = GetBE16(pData + 3);
+            debugI("Finder firmware: %d.%d", uFWVersion/10, uFWVersion%10);
+        }
+    }
+    else
+    {
+        // successful read refills retry budget
+        if (iRetryBudget < MB_RETRY_BUDGET)
+            iRetryBudget++;
+        if (iRetryBudget == MB_RETRY_BUDGET)
+            eHealth = MH_HEALTHY;
+
+        unsigned int uBlock = ctx.uBlock;
+        if (uBlock < pMap->uNBlocks)
         {
-            switch (token & 0xffffL)
+            const mb_block_t *pB = &pMap->pBlocks[uBlock];
+            if (uLen >= 3 + 2*pB->uWords)
             {
-                case SDM_FREQUENCY: 
-                    fFrequency = toFloat( response);
-                    break;
-                case SDM_IMPORT_ACTIVE_ENERGY: 
-                    fEnergyIn = toFloat( response);
-                    break;
-                case SDM_EXPORT_ACTIVE_ENERGY: 
-                    fEnergyOut = toFloat( response);
-                    break;
-                case SDM_PHASE_1_VOLTAGE:
-                    fPhaseVoltage[0] = toFloat( response);
-                    break;
-                case SDM_PHASE_2_VOLTAGE:
-                    fPhaseVoltage[1] = toFloat( response);
-                    break;
-                case SDM_PHASE_3_VOLTAGE:
-                    fPhaseVoltage[2] = toFloat( response);
-                    break;
-                case SDM_PHASE_1_CURRENT:
-                    fPhaseCurrent[0] = toFloat( response);
-                    break;
-                case SDM_PHASE_2_CURRENT:
-                    fPhaseCurrent[1] = toFloat( response);
-                    break;
-                case SDM_PHASE_3_CURRENT:
-                    fPhaseCurrent[2] = toFloat( response);
-                    break;
-                case SDM_PHASE_1_POWER:
-                    fPhasePower[0] = toFloat( response);
-                    break;
-                case SDM_PHASE_2_POWER:
-                    fPhasePower[1] = toFloat( response);
-                    break;
-                case SDM_PHASE_3_POWER:
-                    fPhasePower[2] = toFloat( response);
-                    break;
-                case SDM_PHASE_1_APPARENT_POWER:
-                    fApparentPower[0] = toFloat( response);
-                    break;
-                case SDM_PHASE_2_APPARENT_POWER:
-                    fApparentPower[1] = toFloat( response);
-                    break;
-                case SDM_PHASE_3_APPARENT_POWER:
-                    fApparentPower[2] = toFloat( response);
-                    break;
-                case SDM_PHASE_1_REACTIVE_POWER:
-                    fReactivePower[0] = toFloat( response);
-                    break;
-                case SDM_PHASE_2_REACTIVE_POWER:
-                    fReactivePower[1] = toFloat( response);
-                    break;
-                case SDM_PHASE_3_REACTIVE_POWER:
-                    fReactivePower[2] = toFloat( response);
-                    break;
+                // update shadow image (writer side of seqlock)
+                uint32_t ulS = ulShadowSeq.load(std::memory_order_relaxed);
+                ulShadowSeq.store(ulS + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                memcpy(pShadow + 2*auShadowOff[uBlock], pData + 3, 2*pB->uWords);
+                aulShadowTime[uBlock] = millis() | 1;     // 0: never read
+                ulShadowSeq.store(ulS + 2, std::memory_order_release);
+
+                allBlockTime[uBlock] = llAcquired;
+                Derived.Update(DecodeBlock(pB, pData + 3), millis());
             }
+            else
+                debugD("short response: %d bytes for %d words", uLen, pB->uWords);
         }
-        if (token & TOK_FINAL)
+        // last block of a cycle, late responses of an older cycle do not count
+        if ((uBlock == uCycleBlock) && (ctx.ulCycle == iCycles))
         {
             iCycles++;
+            Publish();
         }
     }
 }
@@ -314,197 +557,1776 @@ void ModBusMeter::handleMeterData(ModbusMessage response, uint32_t token)
  * @brief Define an onError handler function to receive error responses
  * 
  * @param error error code
- * @param token user-supplied token to identify the causing request
+ * @param ctx   context of the causing request
  */
-void ModBusMeter::handleMeterError(Error error, uint32_t token) 
+void ModBusMeter::handleMeterError(Error error, const mb_reqctx_t &ctx) 
 {
   // ModbusError wraps the error code and provides a readable error message for it
   ModbusError me(error);
   debugD("Error response: %02X - %s", (int)me, (const char *)me);
   iErrCnt++;
   iLastErr = error;
-  
-  // reset connected status
+
+  if (ctx.uBlock == MB_BLOCK_PROBE)
+  {
+      if (fConnected)
+          return;     // late answer of a connect request
+
+      // exception response: device is alive
+      if (error < TIMEOUT)
+      {
+          handleMeterData(NULL, 0, ctx);
+          return;
+      }
+
+      // failed connect request: wait longer
+      if (iBackoff < 16)
+          iBackoff++;
+      ulProbeDue = millis() + BackoffDelay();
+      return;
+  }
+
+  // late error of a block read from before the meter went offline
+  if (!fConnected)
+      return;
+
+  // a failed last block ends its cycle as well, the values of the failed blocks are kept
+  if ((ctx.uBlock == uCycleBlock) && (ctx.ulCycle == iCycles))
+  {
+      iCycles++;
+      Publish();
+  }
+
+  // exception response: device is alive
+  if (error < TIMEOUT)
+      return;
+
+  // transport error: consume retry budget, offline if exhausted
+  if (--iRetryBudget > 0)
+  {
+      eHealth = MH_DEGRADED;
+      return;
+  }
+
+  debugI("Meter %d offline", iDeviceAddr);
   fConnected = false;
+  eHealth = MH_OFFLINE;
+  iBackoff = 0;
+  ulProbeDue = millis() + BackoffDelay();
 }
 
-Error ModBusMeter::FireConnectRequest(void)
+/**
+ * @brief spread of the acquisition times of the blocks read every cycle
+ * 
+ * @return uint32_t latest - earliest read [us]
+ */
+uint32_t ModBusMeter::GetCycleSkew(void)
 {
-    uint32_t uStartToken = TOK_START;
+    ePollClass ePoll = pMap->pBlocks[uCycleBlock].ePoll;
+    int64_t llFirst = 0;
+    int64_t llLast = 0;
 
-    if (eDeviceType == MT_FINDER)
-    {   
-        // start with Firmware holding register
-        return  MB.addRequest(uStartToken, iDeviceAddr, READ_HOLD_REGISTER, FINDER_FIRMWARE_VERSION, 1);
+    for (int i=0; i<pMap->uNBlocks; i++)
+    {
+        int64_t llT = allBlockTime[i];
+        if ((pMap->pBlocks[i].ePoll != ePoll) || (llT == 0))
+            continue;
+        if ((llFirst == 0) || (llT < llFirst))
+            llFirst = llT;
+        if (llT > llLast)
+            llLast = llT;
     }
-    else if (eDeviceType == MT_DDM)
-        return  MB.addRequest(uStartToken, iDeviceAddr, READ_INPUT_REGISTER, DDM_PHASE_1_VOLTAGE, 2);
-    else
-        return  MB.addRequest(uStartToken, iDeviceAddr, READ_INPUT_REGISTER, SDM_PHASE_1_VOLTAGE, 2);
+    return (uint32_t)(llLast - llFirst);
 }
 
+/**
+ * @brief publish the values of a complete cycle (writer side of seqlock)
+ *        only called by the eModbus task
+ */
+void ModBusMeter::Publish(void)
+{
+    uint32_t ulS = ulSeq.load(std::memory_order_relaxed);
+
+    ulSeq.store(ulS + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(pvPublic, pvChannel, GetNumberOfChannels() * sizeof(mb_value_t));
+    ulPublicCycle = iCycles;
+    ulPublicTime = millis();
+    ulPublicChanged = ulChanged;
+    Derived.Get(PublicDerived);
+    memcpy(allPublicBlockTime, allBlockTime, sizeof(allPublicBlockTime));
+    ulPublicSkew = GetCycleSkew();
+    for (int ch=0; ch<CH_COUNT; ch++)
+    {
+        if (ulChanged & (1UL << ch))
+            aulChangeCycle[ch] = iCycles;
+    }
+    ulChanged = 0;
+    ulSeq.store(ulS + 2, std::memory_order_release);
+}
 
-void ModBusMeter::FireDataRequest(void)
+/**
+ * @brief copy the values of the last complete cycle (reader side of seqlock)
+ *        retries, if the eModbus task publishes during the copy
+ * 
+ * @param snap  [out] values by eChannel, cycle and time
+ */
+void ModBusMeter::GetSnapshot(mb_snapshot_t &snap)
 {
-    if (fConnected)
+    const mb_chlayout_t *pL = pMap->pLayout;
+    uint32_t ulS;
+
+    do
     {
-        //
-        // put all requests in queue
-        // code device type and register into token
-        //
-        uint32_t uT = ((uint32_t)eDeviceType + 1) << 16;
+        ulS = ulSeq.load(std::memory_order_acquire);
+        if (ulS & 1)
+            continue;       // update in progress
+        for (int ch=0; ch<CH_COUNT; ch++)
+            snap.avChannel[ch] = ((pL->auSlot[ch] != MB_CH_NONE) && pvPublic) ? pvPublic[pL->auSlot[ch]] : 0;
+        snap.ulCycle = ulPublicCycle;
+        snap.ulTime = ulPublicTime;
+        snap.ulChanged = ulPublicChanged;
+        snap.derived = PublicDerived;
+        memcpy(snap.allBlockTime, allPublicBlockTime, sizeof(snap.allBlockTime));
+        snap.ulSkew = ulPublicSkew;
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((ulS & 1) || (ulS != ulSeq.load(std::memory_order_relaxed)));
+}
 
-        if (eDeviceType == MT_FINDER)
-        {
-            MB.addRequest(uT + FINDER_PHASE_1_VOLTAGE , iDeviceAddr, READ_HOLD_REGISTER, FINDER_PHASE_1_VOLTAGE, 1);
-            MB.addRequest(uT + FINDER_PHASE_1_CURRENT , iDeviceAddr, READ_HOLD_REGISTER, FINDER_PHASE_1_CURRENT, 1);
-            MB.addRequest(uT + FINDER_PHASE_1_POWER , iDeviceAddr, READ_HOLD_REGISTER, FINDER_PHASE_1_POWER, 1);
-            MB.addRequest(uT + FINDER_PHASE_1_REACTIVE_POWER , iDeviceAddr, READ_HOLD_REGISTER, FINDER_PHASE_1_REACTIVE_POWER, 1);
-            MB.addRequest(uT + FINDER_IMPORT_ACTIVE_ENERGY , iDeviceAddr, READ_HOLD_REGISTER, FINDER_IMPORT_ACTIVE_ENERGY, 2);
-            // mark last request in cycle:
-            uT |= TOK_FINAL;                
-            MB.addRequest(uT + FINDER_EXPORT_ACTIVE_ENERGY , iDeviceAddr, READ_HOLD_REGISTER, FINDER_EXPORT_ACTIVE_ENERGY, 2);
-        }
-        else if (eDeviceType == MT_DDM)
-        {
-            debugD("DDM not yet supported");
-        }
-        else
-        {
-            int i;
-            for (i=0; i<3; i++)
-            {
-                // 3 phase phase meters (SDM 630) scan all or only phase 1
-                if ( (eDeviceType == MT_SDM630) || (i<1) )
-                {
-                    MB.addRequest(uT + SDM_PHASE_1_VOLTAGE + 2*i, iDeviceAddr, READ_INPUT_REGISTER, SDM_PHASE_1_VOLTAGE + 2*i, 2);
-                    MB.addRequest(uT + SDM_PHASE_1_CURRENT + 2*i, iDeviceAddr, READ_INPUT_REGISTER, SDM_PHASE_1_CURRENT + 2*i, 2);
-                    MB.addRequest(uT + SDM_PHASE_1_POWER + 2*i, iDeviceAddr, READ_INPUT_REGISTER, SDM_PHASE_1_POWER + 2*i, 2);
-                    MB.addRequest(uT + SDM_PHASE_1_APPARENT_POWER + 2*i, iDeviceAddr, READ_INPUT_REGISTER, SDM_PHASE_1_APPARENT_POWER + 2*i, 2);
-                    MB.addRequest(uT + SDM_PHASE_1_REACTIVE_POWER + 2*i, iDeviceAddr, READ_INPUT_REGISTER, SDM_PHASE_1_REACTIVE_POWER + 2*i, 2);
-                }
-            }
-            MB.addRequest(uT + SDM_FREQUENCY, iDeviceAddr, READ_INPUT_REGISTER, SDM_FREQUENCY, 2);
-            MB.addRequest(uT + SDM_IMPORT_ACTIVE_ENERGY, iDeviceAddr, READ_INPUT_REGISTER, SDM_IMPORT_ACTIVE_ENERGY, 2);
-            // mark last request in cycle:
-            uT |= TOK_FINAL;
-            MB.addRequest(uT + SDM_EXPORT_ACTIVE_ENERGY, iDeviceAddr, READ_INPUT_REGISTER, SDM_EXPORT_ACTIVE_ENERGY, 2);
-        }
-    }
-    else
+/**
+ * @brief channels changed after a cycle (reader side of seqlock)
+ *        a consumer, that skips cycles, gets all changes since the cycle it has seen last
+ * 
+ * @param ulCycle   last cycle seen by the consumer, 0: none
+ * @return uint32_t channels changed in later cycles, bit by eChannel
+ */
+uint32_t ModBusMeter::GetChangedSince(uint32_t ulCycle)
+{
+    uint32_t ulMask;
+    uint32_t ulS;
+
+    do
     {
-        // retry to connect...
-        Error err = FireConnectRequest();
-        if (err != SUCCESS) 
+        ulS = ulSeq.load(std::memory_order_acquire);
+        if (ulS & 1)
+            continue;       // update in progress
+        ulMask = 0;
+        for (int ch=0; ch<CH_COUNT; ch++)
         {
-            ModbusError e(err);
-            debugD("Error creating request: %02X - %s", (int)e, (const char *)e);
+            if ((aulChangeCycle[ch] != 0) && ((int32_t)(aulChangeCycle[ch] - ulCycle) > 0))
+                ulMask |= 1UL << ch;
         }
-    }
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((ulS & 1) || (ulS != ulSeq.load(std::memory_order_relaxed)));
+    return ulMask;
 }
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void handleData(ModbusMessage response, uint32_t token)
+/**
+ * @brief read registers from the shadow image (reader side of seqlock)
+ *        the registers have to be covered by one block read of the read plan
+ * 
+ * @param uFC       function code
+ * @param uAddr     first register
+ * @param uWords    # of registers
+ * @param pDst      [out] register values, big endian
+ * @return Error    SUCCESS, ILLEGAL_DATA_ADDRESS: not in read plan, GATEWAY_TARGET_NO_RESP: too old
+ */
+Error ModBusMeter::ReadShadow(uint8_t uFC, uint16_t uAddr, uint16_t uWords, uint8_t *pDst)
 {
-    debugV("Response: serverID=%d, FC=%d, Token=%08X, length=%d:", response.getServerID(), response.getFunctionCode(), token, response.size());
-    
-    // get meter instance from server id
-    for (int i = 0; i<iNMeters; i++)
+    int iBlock = -1;
+
+    for (int i=0; i<pMap->uNBlocks; i++)
     {
-        if (response.getServerID() == ModMeters[i].GetDeviceAddr() )
+        const mb_block_t *pB = &pMap->pBlocks[i];
+        if ((pB->uFC == uFC) && (uAddr >= pB->uStart) && (uAddr + uWords <= pB->uStart + pB->uWords))
         {
-            token &= 0x00ffffffL;   // mask out possible id
-            ModMeters[i].handleMeterData(response, token);
+            iBlock = i;
             break;
         }
     }
+    if ((iBlock < 0) || (pShadow == NULL))
+        return ILLEGAL_DATA_ADDRESS;
+
+    const mb_block_t *pB = &pMap->pBlocks[iBlock];
+    uint32_t ulMaxAge = ulShadowMaxAge ? ulShadowMaxAge : 3 * PollInterval(pB->ePoll);
+    uint32_t ulTime;
+    uint32_t ulS;
+
+    do
+    {
+        ulS = ulShadowSeq.load(std::memory_order_acquire);
+        if (ulS & 1)
+            continue;       // update in progress
+        memcpy(pDst, pShadow + 2*(auShadowOff[iBlock] + uAddr - pB->uStart), 2*uWords);
+        ulTime = aulShadowTime[iBlock];
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((ulS & 1) || (ulS != ulShadowSeq.load(std::memory_order_relaxed)));
+
+    if ((ulTime == 0) || ((millis() - ulTime) > ulMaxAge))
+        return GATEWAY_TARGET_NO_RESP;
+    return SUCCESS;
 }
 
-void handleError(Error error, uint32_t token) 
+/**
+ * @brief exponential reconnect delay with jitter
+ *        MB_BACKOFF_MIN * 2^n, max MB_BACKOFF_MAX, +-25% jitter so meters do not probe in lockstep
+ * 
+ * @return uint32_t delay [ms]
+ */
+uint32_t ModBusMeter::BackoffDelay(void)
 {
-  // ModbusError wraps the error code and provides a readable error message for it
-  ModbusError me(error);
-  debugD("Error response: %02X - %s", (int)me, (const char *)me);
- 
+    uint32_t ulDelay = MB_BACKOFF_MIN;
+
+    for (int i=0; (i<iBackoff) && (ulDelay < MB_BACKOFF_MAX); i++)
+        ulDelay *= 2;
+    if (ulDelay > MB_BACKOFF_MAX)
+        ulDelay = MB_BACKOFF_MAX;
+    return ulDelay - ulDelay / 4 + esp_random() % (ulDelay / 2 + 1);
+}
+
+const char *ModBusMeter::GetHealthText(void)
+{
+    switch (eHealth)
+    {
+        case MH_HEALTHY:
+            return "healthy";
+        case MH_DEGRADED:
+            return "degraded";
+        default:
+            return "offline";
+    }
 }
 
 /**
- * @brief prepare the ModBus communication
+ * @brief record the response delay of a request 
+ *        the delay of the device is the round trip time without the frames on the bus,
+ *        p99 is a streaming estimate: it rises fast with slow responses and decays slowly 
  * 
- * @param baudrate  : baudrate              (default: 9600)
- * @param iN        : number or meters      (1..4)
- * @param *dt       : type of Modbus meter  (array of device types
- * @param *devadr   : device adr            (array of device addresses
+ * @param ulRtt     round trip time of the request [us]
+ * @param ulBusUs   time of request and response frames on the bus [us]
  */
-void StartModBus(uint32_t baudrate, int iN, eMeterType *dt, uint16_t *devadr)
+void ModBusMeter::UpdateRtt(uint32_t ulRtt, uint32_t ulBusUs)
 {
-    debugD("StartModBus with %d devices at Baudrate %d", iN, baudrate);
-    if (iN > MAX_METERS)
+    float fDelay = (ulRtt > ulBusUs) ? (float)(ulRtt - ulBusUs) : 0.0;
+
+    if (ulRtt > ulRttMax)
+        ulRttMax = ulRtt;
+    if (ulRttN == 0)
     {
-        debugD("StartModBus clip to max. %d devices", MAX_METERS);
-        iNMeters = MAX_METERS;
+        fRttAvg = fDelay;
+        fRttP99 = fDelay;
     }
     else
-        iNMeters = iN;  
-        
-    for (int i = 0; i<iNMeters; i++)
     {
-        debugD("%d: Type: %s, Addr: %d", i, ModMeters[i].MeterType2Text(*dt), *devadr);
-        ModMeters[i].SetMeter(*dt, *devadr);
-        ++dt;
-        ++devadr;
+        float fStep = max(100.0f, fRttP99 / 32.0f);
+        fRttAvg += (fDelay - fRttAvg) / 16.0;
+        if (fDelay > fRttP99)
+            fRttP99 += fStep * 0.99;
+        else
+            fRttP99 -= fStep * 0.01;
     }
+    ulRttN++;
+}
 
-    // Set up Serial2 connected to Modbus RTU
-    // ttgo lora pins for Serial2 => RX pin 35, TX pin 13, pin 17: RTS (Rx/Tx switch)
-    pinMode(17, OUTPUT);
-    // SDM support 8Bit, 1 stop, no parity
-    Serial2.begin(baudrate, SERIAL_8N1, 35, 13);
-    
-    // Set up ModbusRTU client.
-    // - provide onData handler function
-    MB.onDataHandler(&handleData);
-    // - provide onError handler function
-    MB.onErrorHandler(&handleError);
-    // Set message timeout to 2000ms
-    MB.setTimeout(2000);
-    // Start ModbusRTU background task
-    MB.begin();
+/**
+ * @brief response timeout for the next request to this device
+ * 
+ * @return uint32_t timeout [ms]
+ */
+uint32_t ModBusMeter::GetTimeout(void)
+{
+    if (ulRttN < MB_RTT_MIN_SAMPLES)
+        return MB_TIMEOUT_INIT;
 
-    // Start 'connect' request
-    for (int i = 0; i<iNMeters; i++)
+    uint32_t ulTimeout = (uint32_t)(MB_TIMEOUT_FACTOR * fRttP99 / 1000.0);
+    return constrain(ulTimeout, MB_TIMEOUT_MIN, MB_TIMEOUT_MAX);
+}
+
+/**
+ * @brief find the due block read with the earliest deadline
+ *        the deadline of a block is the end of its poll interval
+ * 
+ * @param ulNow         current time [ms]
+ * @param ulDeadline    [out] deadline of the returned block
+ * @return int          block index, MB_BLOCK_PROBE for the connect request, -1: nothing due
+ */
+int ModBusMeter::GetDueBlock(uint32_t ulNow, uint32_t &ulDeadline)
+{
+    int iBlock = -1;
+
+    if (!fConnected)
+    {
+        // no connect request: meter type unknown, never polled
+        if ((pMap->uProbeWords == 0) || ((int32_t)(ulNow - ulProbeDue) < 0))
+            return -1;
+        // lowest priority: latest deadline
+        ulDeadline = ulProbeDue + MB_BACKOFF_MAX;
+        return MB_BLOCK_PROBE;
+    }
+
+    for (int i=0; i<pMap->uNBlocks; i++)
     {
-        Error err = ModMeters[i].FireConnectRequest();
-        if (err != SUCCESS) 
+        if ((int32_t)(ulNow - aulDue[i]) >= 0)
         {
-            ModbusError e(err);
-            debugD("Error creating request: %02X - %s", (int)e, (const char *)e);
+            uint32_t ulD = aulDue[i] + PollInterval(pMap->pBlocks[i].ePoll);
+            if (fAlignPolling && (i == iAlignBlock))
+                ulD = aulDue[i];    // aligned power block: ahead of all blocks due at the same time
+            if ((iBlock < 0) || ((int32_t)(ulD - ulDeadline) < 0))
+            {
+                iBlock = i;
+                ulDeadline = ulD;
+            }
         }
     }
-} 
-
-static long _tmMillis = 0;
+    return iBlock;
+}
 
 /**
- * @brief Loop function for Modbus
- *        start cycle every 10s
+ * @brief request for one block read (or the connect request) and schedule its next poll
+ *        a block read is dropped from the queue at the end of its poll interval, 
+ *        the connect request when the next one is due
  * 
+ * @param iBlock    block index from GetDueBlock()
+ * @param ulNow     current time [ms]
+ * @param e         [out] request for the priority queue
  */
-void ModBusHandle(void)
+void ModBusMeter::QueueBlock(int iBlock, uint32_t ulNow, mb_qentry_t &e)
 {
-    if ((millis() - _tmMillis) > MODBUSCYCLE * 1000L)
+    e.ulEnqueued = ulNow;
+    e.fDeadline = true;
+    e.uMeter = iMeterIdx;
+    e.uBlock = iBlock;
+    e.uServer = iDeviceAddr;
+    e.uTimeout = GetTimeout();
+
+    if (iBlock == MB_BLOCK_PROBE)
     {
-        debugD("inside ModBusHandle with %d", _tmMillis);
-        for (int i = 0; i<iNMeters; i++)
-            ModMeters[i].FireDataRequest();
-        
-        _tmMillis = millis();
+        // next try, if this one gets lost, lowest priority: latest deadline
+        e.ulKey = ulProbeDue + MB_BACKOFF_MAX;
+        ulProbeDue = ulNow + BackoffDelay();
+        e.ulDeadline = ulProbeDue;
+        e.uFC = pMap->uProbeFC;
+        e.uAddr = pMap->uProbeAddr;
+        e.uWords = pMap->uProbeWords;
+        return;
+    }
+
+    const mb_block_t *pB = &pMap->pBlocks[iBlock];
+    uint32_t ulT = PollInterval(pB->ePoll);
+
+    aulDue[iBlock] += ulT;
+    if ((int32_t)(ulNow - aulDue[iBlock]) >= 0)
+    {
+        // missed a complete poll interval: bus is over capacity
+        iOverruns++;
+        aulDue[iBlock] = ulNow + ulT;
+    }
+    e.ulKey = aulDue[iBlock];
+    e.ulDeadline = aulDue[iBlock];
+    if (fAlignPolling && (iBlock == iAlignBlock))
+    {
+        // next poll on the grid common to all meters, sent ahead of the other blocks due then
+        uint32_t ulOff = (aulDue[iBlock] - ulAlignEpoch) % ulT;
+        if (ulOff)
+            aulDue[iBlock] += ulT - ulOff;
+        e.ulKey -= ulT;
+    }
+    e.uFC = pB->uFC;
+    e.uAddr = pB->uStart;
+    e.uWords = pB->uWords;
+}
+
+/**
+ * @brief estimated bus time for all block reads in one second
+ * 
+ * @param baudrate  bus speed
+ * @return float    bus time [ms]
+ */
+float ModBusMeter::GetBusTime(uint32_t baudrate)
+{
+    float fTime = 0.0;
+
+    for (int i=0; i<pMap->uNBlocks; i++)
+    {
+        // 8N1: 10 bit per char, request 8 bytes, response 5 bytes + data, 3.5 chars silence each
+        uint32_t ulBits = (8 + 5 + 2 * pMap->pBlocks[i].uWords) * 10 + 2 * 35;
+        float fBlock = ulBits * 1000.0 / baudrate + MB_TURNAROUND_MS;
+        fTime += fBlock * 1000.0 / PollInterval(pMap->pBlocks[i].ePoll);
+    }
+    return fTime;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief take a slot of the request context table
+ *        has to be called with MBaccess locked
+ * 
+ * @param token     [out] token for eModbus
+ * @return mb_reqctx_t* context, NULL: table full
+ */
+static mb_reqctx_t *ReqAlloc(uint32_t &token)
+{
+    if (iReqFree <= 0)
+        return NULL;
+
+    uint8_t uSlot = auReqFree[--iReqFree];
+    mb_reqctx_t *pCtx = &aReqCtx[uSlot];
+    pCtx->uGen++;
+    pCtx->fUsed = true;
+    token = ((uint32_t)pCtx->uGen << 8) | uSlot;
+    return pCtx;
+}
+
+static void ReqFree(mb_reqctx_t *pCtx)
+{
+    pCtx->fUsed = false;
+    auReqFree[iReqFree++] = pCtx - aReqCtx;
+}
+
+/**
+ * @brief find the context of a request by its token
+ *        has to be called with MBaccess locked
+ * 
+ * @return mb_reqctx_t* context, NULL: unknown or stale token
+ */
+static mb_reqctx_t *ReqLookup(uint32_t token)
+{
+    uint32_t uSlot = TOK_SLOT(token);
+
+    if ((uSlot >= MB_REQ_SLOTS) || (token >> 16))
+        return NULL;
+    mb_reqctx_t *pCtx = &aReqCtx[uSlot];
+    if (!pCtx->fUsed || (pCtx->uGen != TOK_GEN(token)))
+        return NULL;
+    return pCtx;
+}
+
+/**
+ * @brief queue a discovery request
+ *        has to be called with MBaccess locked
+ */
+static void DiscoveryRequest(int iAddr, int iTest, uint8_t uFC, uint16_t uReg, uint16_t uWords, uint16_t uTimeout)
+{
+    mb_qentry_t e;
+
+    e.ulEnqueued = millis();
+    e.ulKey = e.ulEnqueued;
+    e.fDeadline = false;
+    e.uMeter = MB_CTX_DISCOVERY;
+    e.uBlock = iTest;
+    e.uServer = iAddr;
+    e.uFC = uFC;
+    e.uAddr = uReg;
+    e.uWords = uWords;
+    e.uTimeout = uTimeout;
+    MBQ.Push(PRIO_DISCOVERY, e);
+}
+
+/**
+ * @brief bus discovery: sweep all addresses, then check fingerprints at the responders
+ *        the sweep keeps several probes in the eModbus queue with a short timeout, 
+ *        so the next probe is sent without waiting for the response handler
+ *        has to be called with MBaccess locked
+ */
+static void DiscoverySchedule(void)
+{
+    if (eDiscState == DS_SWEEP)
+    {
+        while (MBQ.HasRoom(PRIO_DISCOVERY) && (iDiscAddr <= MB_ADDR_MAX))
+        {
+            DiscoveryRequest(iDiscAddr, MB_BLOCK_PROBE, MB_DISC_FC, MB_DISC_REG, MB_DISC_WORDS, MB_DISC_TIMEOUT);
+            iDiscAddr++;
+        }
+        if ((iDiscAddr <= MB_ADDR_MAX) || (iDiscInFlight > 0) || MBQ.GetDepth(PRIO_DISCOVERY))
+            return;
+
+        // sweep done, identify responders
+        debugI("discovery: sweep done");
+        eDiscState = DS_FINGERPRINT;
+        iDiscAddr = MB_ADDR_MIN;
+        iDiscTest = 0;
+    }
+
+    if ((eDiscState != DS_FINGERPRINT) || (iDiscInFlight > 0) || MBQ.GetDepth(PRIO_DISCOVERY))
+        return;
+
+    int iNFP;
+    const mb_fingerprint_t *pFP = GetFingerprints(iNFP);
+
+    // next responder, that is not identified
+    for ( ; iDiscAddr <= MB_ADDR_MAX; iDiscAddr++, iDiscTest = 0)
+    {
+        if (!(aulDiscAlive[iDiscAddr / 32] & (1UL << (iDiscAddr % 32))))
+            continue;
+        if (iDiscTest < iNFP)
+            break;
+        debugI("discovery: unknown device at %d", iDiscAddr);
+    }
+    if ((iDiscAddr > MB_ADDR_MAX) || (iDiscFound >= MAX_METERS))
+    {
+        debugI("discovery: %d meters found", iDiscFound);
+        eDiscState = DS_DONE;
+        return;
+    }
+
+    pFP += iDiscTest;
+    DiscoveryRequest(iDiscAddr, iDiscTest, pFP->uFC, pFP->uAddr, pFP->uWords, MB_TIMEOUT_INIT);
+}
+
+/**
+ * @brief response of a discovery request
+ *        has to be called with MBaccess locked
+ * 
+ * @param ctx       context of request
+ * @param error     SUCCESS: data response, else error code
+ */
+static void DiscoveryResponse(const mb_reqctx_t &ctx, Error error)
+{
+    if (eDiscState == DS_SWEEP)
+    {
+        // data or exception response: a device answers at this address
+        if ((error == SUCCESS) || (error < TIMEOUT))
+        {
+            debugD("discovery: device at %d", ctx.uServer);
+            aulDiscAlive[ctx.uServer / 32] |= 1UL << (ctx.uServer % 32);
+        }
+    }
+    else if ((eDiscState == DS_FINGERPRINT) && (ctx.uServer == iDiscAddr))
+    {
+        if (error == SUCCESS)
+        {
+            int iNFP;
+            const mb_fingerprint_t *pFP = GetFingerprints(iNFP);
+
+            debugI("discovery: %s at %d", GetMeterMap(pFP[ctx.uBlock].eType)->pszName, ctx.uServer);
+            aeDiscType[iDiscFound] = pFP[ctx.uBlock].eType;
+            auDiscAddr[iDiscFound] = ctx.uServer;
+            iDiscFound++;
+            iDiscAddr++;
+            iDiscTest = 0;
+        }
+        else
+            iDiscTest++;    // try next fingerprint
+    }
+}
+
+/**
+ * @brief fairness entry of a bridge client, replaces the client with the oldest virtual time if unknown
+ *        has to be called with MBaccess locked
+ */
+static mb_bridgeclient_t *BridgeClient(void *pClient)
+{
+    mb_bridgeclient_t *pOld = &aBridgeClient[0];
+
+    for (int i=0; i<MB_BRIDGE_CLIENTS; i++)
+    {
+        if (aBridgeClient[i].pClient == pClient)
+            return &aBridgeClient[i];
+        if ((int32_t)(aBridgeClient[i].ulVTime - pOld->ulVTime) < 0)
+            pOld = &aBridgeClient[i];
+    }
+    pOld->pClient = pClient;
+    pOld->ulVTime = millis();
+    return pOld;
+}
+
+static void BridgeFree(mb_bridgejob_t *pJ)
+{
+    if (pJ->eState == BJ_QUEUED)
+        MBQ.Remove(PRIO_INTERACTIVE, MB_CTX_BRIDGE, pJ - aBridge);
+    pJ->eState = BJ_FREE;
+    xQueueReset(pJ->hDone);     // gives of waiters, that timed out
+}
+
+/**
+ * @brief response timeout of a device, MB_TIMEOUT_INIT if not polled
+ *        has to be called with MBaccess locked
+ */
+static uint32_t DeviceTimeout(uint8_t uServer)
+{
+    for (int i = 0; i<iNMeters; i++)
+    {
+        if (ModMeters[i].GetDeviceAddr() == uServer)
+            return ModMeters[i].GetTimeout();
+    }
+    return MB_TIMEOUT_INIT;
+}
+
+/**
+ * @brief find a transaction to join or queue a new one
+ *        joins a transaction covering the read, or widens a queued transaction overlapping it.
+ *        A new transaction is queued as interactive request, ordered by the virtual time of its client:
+ *        a client with many transactions does not delay the first one of another client.
+ *        has to be called with MBaccess locked
+ * 
+ * @return mb_bridgejob_t* transaction, NULL: no free transaction, client has too many queued or queue full
+ */
+static mb_bridgejob_t *BridgeJoin(void *pClient, uint8_t uServer, uint8_t uFC, uint16_t uAddr, uint16_t uWords, uint32_t ulTimeout)
+{
+    mb_bridgejob_t *pFree = NULL;
+    int iQueued = 0;
+
+    for (int i=0; i<MB_BRIDGE_JOBS; i++)
+    {
+        mb_bridgejob_t *pJ = &aBridge[i];
+
+        if (pJ->eState == BJ_FREE)
+        {
+            if (pFree == NULL)
+                pFree = pJ;
+            continue;
+        }
+        if ((pJ->eState == BJ_QUEUED) && (pJ->pClient == pClient))
+            iQueued++;
+        if ((pJ->eState == BJ_DONE) || (pJ->uServer != uServer) || (pJ->uFC != uFC) || (pJ->iWaiters >= MB_BRIDGE_WAITERS))
+            continue;
+
+        // same read in flight or queued: single flight
+        if ((uAddr >= pJ->uAddr) && (uAddr + uWords <= pJ->uAddr + pJ->uWords))
+            return pJ;
+
+        // overlapping read not yet on bus: merge into one wider read
+        // adjacent reads stay apart: an exception for an invalid range of one client must not fail the read of another
+        uint16_t uStart = min(uAddr, pJ->uAddr);
+        uint16_t uEnd = max(uAddr + uWords, pJ->uAddr + pJ->uWords);
+        if ((pJ->eState == BJ_QUEUED) && (uAddr < pJ->uAddr + pJ->uWords) && (pJ->uAddr < uAddr + uWords)
+            && (uEnd - uStart <= MB_MAX_BLOCK_WORDS))
+        {
+            pJ->uAddr = uStart;
+            pJ->uWords = uEnd - uStart;
+            return pJ;
+        }
+    }
+    if ((pFree == NULL) || (iQueued >= MB_BRIDGE_PER_CLIENT) || !MBQ.HasRoom(PRIO_INTERACTIVE))
+        return NULL;
+
+    uint32_t ulNow = millis();
+    mb_bridgeclient_t *pC = BridgeClient(pClient);
+    mb_qentry_t e;
+
+    e.ulEnqueued = ulNow;
+    e.ulKey = ((int32_t)(pC->ulVTime - ulNow) > 0) ? pC->ulVTime : ulNow;
+    pC->ulVTime = e.ulKey + MB_BRIDGE_QUANTUM;
+    e.ulDeadline = ulNow + ulTimeout;       // all waiters gave up
+    e.fDeadline = true;
+    e.uMeter = MB_CTX_BRIDGE;
+    e.uBlock = pFree - aBridge;
+    e.uServer = uServer;
+    e.uFC = uFC;
+    e.uAddr = uAddr;            // range of transaction at dispatch
+    e.uWords = uWords;
+    e.uTimeout = DeviceTimeout(uServer);
+    MBQ.Push(PRIO_INTERACTIVE, e);
+
+    pFree->eState = BJ_QUEUED;
+    pFree->uServer = uServer;
+    pFree->uFC = uFC;
+    pFree->uAddr = uAddr;
+    pFree->uWords = uWords;
+    pFree->pClient = pClient;
+    pFree->iWaiters = 0;
+    return pFree;
+}
+
+/**
+ * @brief bridged transaction done: wake all waiters
+ *        has to be called with MBaccess locked
+ */
+static void BridgeDone(mb_bridgejob_t *pJ, Error error, const ModbusMessage *pResponse)
+{
+    pJ->err = error;
+    if (pResponse)
+    {
+        if (pResponse->size() >= 3 + 2 * pJ->uWords)
+            memcpy(pJ->abData, pResponse->data() + 3, 2 * pJ->uWords);
+        else
+            pJ->err = PACKET_LENGTH_ERROR;
+    }
+    pJ->eState = BJ_DONE;
+    if (pJ->iWaiters == 0)
+        BridgeFree(pJ);
+    for (int i=0; i<pJ->iWaiters; i++)
+        xSemaphoreGive(pJ->hDone);
+}
+
+/**
+ * @brief response of a bridged transaction
+ *        has to be called with MBaccess locked
+ */
+static void BridgeResponse(const mb_reqctx_t &ctx, Error error, const ModbusMessage *pResponse)
+{
+    mb_bridgejob_t *pJ = &aBridge[ctx.uBlock];
+
+    if (pJ->eState == BJ_INFLIGHT)
+        BridgeDone(pJ, error, pResponse);
+}
+
+/**
+ * @brief end a write job with a result
+ *        has to be called with MBaccess locked
+ */
+static void WriteDone(mb_writejob_t *pJ, eWriteState eState, Error err, uint16_t uAddr)
+{
+    pJ->eState = eState;
+    pJ->err = err;
+    pJ->uFailAddr = uAddr;
+    pJ->ulDone = millis();
+    if (eState == WS_DONE)
+        debugI("write job %d to %d done", pJ - aWrite, pJ->uServer);
+    else
+        debugW("write job %d to %d: %s at register %d, error %02X", pJ - aWrite, pJ->uServer, WriteState2Text(eState), uAddr, err);
+}
+
+/**
+ * @brief queue the next step of a write job: write of run uRun or its read back
+ *        has to be called with MBaccess locked
+ */
+static void WriteStep(mb_writejob_t *pJ)
+{
+    const mb_writerun_t *pR = &pJ->aRun[pJ->uRun];
+    uint32_t ulNow = millis();
+    mb_qentry_t e;
+
+    e.ulEnqueued = ulNow;
+    e.ulKey = ulNow;            // first come, first served
+    e.ulDeadline = ulNow + MB_WRITE_DEADLINE;
+    e.fDeadline = true;
+    e.uMeter = MB_CTX_WRITE;
+    e.uBlock = pJ - aWrite;
+    e.uServer = pJ->uServer;
+    if (pJ->fReading)
+        e.uFC = READ_HOLD_REGISTER;
+    else
+        e.uFC = (pR->uWords == 1) ? WRITE_HOLD_REGISTER : WRITE_MULT_REGISTERS;
+    e.uAddr = pR->uAddr;
+    e.uWords = pR->uWords;
+    e.uTimeout = DeviceTimeout(pJ->uServer);
+    if (!MBQ.Push(PRIO_CONTROL, e))
+        WriteDone(pJ, WS_FAILED, SERVER_DEVICE_BUSY, pR->uAddr);
+}
+
+/**
+ * @brief response of a write job step: next step, next run or result
+ *        has to be called with MBaccess locked
+ * 
+ * @param pData     response, read back data from byte 3
+ * @param uLen      length of response, 0: error
+ */
+static void WriteResponse(const mb_reqctx_t &ctx, Error error, const uint8_t *pData, uint16_t uLen)
+{
+    mb_writejob_t *pJ = &aWrite[ctx.uBlock];
+    const mb_writerun_t *pR = &pJ->aRun[pJ->uRun];
+
+    if (pJ->eState != WS_BUSY)
+        return;
+    if (error != SUCCESS)
+    {
+        WriteDone(pJ, WS_FAILED, error, pR->uAddr);
+        return;
+    }
+    if (pJ->fReading)
+    {
+        if (uLen < 3 + 2 * pR->uWords)
+        {
+            WriteDone(pJ, WS_FAILED, PACKET_LENGTH_ERROR, pR->uAddr);
+            return;
+        }
+        for (int i=0; i<pR->uWords; i++)
+        {
+            if (((pData[3 + 2*i] << 8) | pData[4 + 2*i]) != pJ->auValue[pR->uFirst + i])
+            {
+                WriteDone(pJ, WS_MISMATCH, SUCCESS, pR->uAddr + i);
+                return;
+            }
+        }
+        pJ->fReading = false;
+    }
+    else if (pJ->fVerify)
+    {
+        pJ->fReading = true;
+        WriteStep(pJ);
+        return;
+    }
+
+    if (++pJ->uRun < pJ->uNRuns)
+        WriteStep(pJ);
+    else
+        WriteDone(pJ, WS_DONE, SUCCESS, 0);
+}
+
+/**
+ * @brief hand a write job step to eModbus
+ *        has to be called with MBaccess locked
+ * 
+ * @param uReqBytes [out] size of request frame
+ */
+static Error WriteFire(uint32_t token, const mb_qentry_t &e, uint16_t &uReqBytes)
+{
+    mb_writejob_t *pJ = &aWrite[e.uBlock];
+    const mb_writerun_t *pR = &pJ->aRun[pJ->uRun];
+    uint16_t *pValues = &pJ->auValue[pR->uFirst];
+
+    switch (e.uFC)
+    {
+        case WRITE_HOLD_REGISTER:
+            uReqBytes = MB_READ_REQ_BYTES;
+            if (Capture.Enabled())
+                Capture.Request(e.uServer, e.uFC, e.uAddr, pValues[0]);
+            return MB.addRequest(token, e.uServer, WRITE_HOLD_REGISTER, e.uAddr, pValues[0]);
+        case WRITE_MULT_REGISTERS:
+            // id, fc, addr, words, byte count, data, CRC
+            uReqBytes = 9 + 2 * e.uWords;
+            if (Capture.Enabled())
+                Capture.Request(e.uServer, e.uFC, e.uAddr, e.uWords, pValues);
+            return MB.addRequest(token, e.uServer, WRITE_MULT_REGISTERS, e.uAddr, e.uWords, (uint8_t)(2 * e.uWords), pValues);
+        default:
+            uReqBytes = MB_READ_REQ_BYTES;
+            if (Capture.Enabled())
+                Capture.Request(e.uServer, e.uFC, e.uAddr, e.uWords);
+            return MB.addRequest(token, e.uServer, e.uFC, e.uAddr, e.uWords);
+    }
+}
+
+/**
+ * @brief request dropped from the queue at its deadline or not accepted by eModbus
+ *        has to be called with MBaccess locked
+ */
+static void QueueDrop(const mb_qentry_t &e)
+{
+    if (e.uMeter == MB_CTX_BRIDGE)
+    {
+        if (aBridge[e.uBlock].eState == BJ_QUEUED)
+            BridgeDone(&aBridge[e.uBlock], GATEWAY_TARGET_NO_RESP, NULL);
+    }
+    else if (e.uMeter == MB_CTX_WRITE)
+    {
+        if (aWrite[e.uBlock].eState == WS_BUSY)
+            WriteDone(&aWrite[e.uBlock], WS_FAILED, GATEWAY_TARGET_NO_RESP, e.uAddr);
+    }
+    else if ((e.uMeter < iNMeters) && (e.uBlock != MB_BLOCK_PROBE))
+    {
+        // block read missed its poll interval
+        ModMeters[e.uMeter].CountOverrun();
+    }
+}
+
+/**
+ * @brief check a request before it is handed to eModbus
+ *        a bridged read takes the current range of its transaction, it may have grown while queued
+ *        has to be called with MBaccess locked
+ * 
+ * @return false    request is obsolete
+ */
+static bool QueueCheck(mb_qentry_t &e)
+{
+    if (e.uMeter == MB_CTX_DISCOVERY)
+        return (eDiscState == DS_SWEEP) || (eDiscState == DS_FINGERPRINT);
+
+    if (e.uMeter == MB_CTX_BRIDGE)
+    {
+        mb_bridgejob_t *pJ = &aBridge[e.uBlock];
+        e.uAddr = pJ->uAddr;
+        e.uWords = pJ->uWords;
+        return pJ->eState == BJ_QUEUED;
+    }
+    if (e.uMeter == MB_CTX_WRITE)
+        return aWrite[e.uBlock].eState == WS_BUSY;
+
+    // block reads of connected meters, connect requests of offline meters
+    if (e.uMeter >= iNMeters)
+        return false;
+    return ModMeters[e.uMeter].isConnected() != (e.uBlock == MB_BLOCK_PROBE);
+}
+
+/**
+ * @brief hand a request to eModbus with its own response timeout
+ *        the timeout of eModbus is global: only requests with the same timeout may be queued together
+ *        has to be called with MBaccess locked
+ */
+static Error QueueFire(const mb_qentry_t &e)
+{
+    uint32_t token;
+    mb_reqctx_t *pCtx = ReqAlloc(token);
+    if (pCtx == NULL)
+        return REQUEST_QUEUE_FULL;
+
+    pCtx->uMeter = e.uMeter;
+    pCtx->uServer = e.uServer;
+    pCtx->uFC = e.uFC;
+    pCtx->uBlock = e.uBlock;
+    pCtx->ulCycle = (e.uMeter < iNMeters) ? ModMeters[e.uMeter].GetCycles() : 0;
+    pCtx->ulIssueMicros = micros();
+
+    // polls and connect requests of the meters are sent from their compiled frames
+    const mb_reqframe_t *pF = (e.uMeter < iNMeters) ? ModMeters[e.uMeter].GetRequestFrame(e.uBlock) : NULL;
+    uint16_t uReqBytes = MB_READ_REQ_BYTES;
+    Error err;
+
+    MB.setTimeout(e.uTimeout);
+    if (e.uMeter == MB_CTX_WRITE)
+        err = WriteFire(token, e, uReqBytes);
+    else if (pF)
+        err = MB.addRequest(pF->Msg, token);
+    else
+        err = MB.addRequest(token, e.uServer, e.uFC, e.uAddr, e.uWords);
+    if (err != SUCCESS)
+    {
+        ReqFree(pCtx);
+        return err;
+    }
+    iInFlight++;
+    if (Capture.Enabled())
+    {
+        if (pF)
+            Capture.Request(pF->abFrame);
+        else if (e.uMeter != MB_CTX_WRITE)
+            Capture.Request(e.uServer, e.uFC, e.uAddr, e.uWords);
+    }
+    BusMetrics.Request(uReqBytes);
+    if (e.uMeter < iNMeters)
+        ModMeters[e.uMeter].GetMetrics().Request(uReqBytes);
+    if (e.uMeter == MB_CTX_DISCOVERY)
+        iDiscInFlight++;
+    else if (e.uMeter == MB_CTX_BRIDGE)
+        aBridge[e.uBlock].eState = BJ_INFLIGHT;
+    return SUCCESS;
+}
+
+/**
+ * @brief earliest deadline first: queue the most urgent due block reads as poll requests
+ *        has to be called with MBaccess locked
+ */
+static void PollSchedule(uint32_t ulNow)
+{
+    // refill bus time for offline meters: MB_OFFLINE_SHARE of elapsed time
+    int32_t lRefill = (ulNow - ulOfflineRefill) * MB_OFFLINE_SHARE / 100;
+    if (lRefill > 0)
+    {
+        lOfflineBudget = min(lOfflineBudget + lRefill, (int32_t)MB_OFFLINE_BUCKET);
+        ulOfflineRefill += lRefill * 100 / MB_OFFLINE_SHARE;
+    }
+
+    while (MBQ.HasRoom(PRIO_POLL))
+    {
+        int iMeter = -1;
+        int iBlock = -1;
+        uint32_t ulBest = 0;
+
+        for (int i = 0; i<iNMeters; i++)
+        {
+            // offline meters only, if their probe fits into the budget
+            if (!ModMeters[i].isConnected() && (lOfflineBudget < (int32_t)ModMeters[i].GetTimeout()))
+                continue;
+
+            uint32_t ulD;
+            int b = ModMeters[i].GetDueBlock(ulNow, ulD);
+            if ((b >= 0) && ((iMeter < 0) || ((int32_t)(ulD - ulBest) < 0)))
+            {
+                iMeter = i;
+                iBlock = b;
+                ulBest = ulD;
+            }
+        }
+        if (iMeter < 0)
+            break;      // nothing due
+
+        mb_qentry_t e;
+        ModMeters[iMeter].QueueBlock(iBlock, ulNow, e);
+        MBQ.Push(PRIO_POLL, e);
+    }
+}
+
+/**
+ * @brief queue due requests and hand the most urgent ones to eModbus
+ *        order: control, interactive, poll, discovery; a request gains one class per MBQ_AGING_MS waiting
+ *        has to be called with MBaccess locked
+ */
+static void MBSchedule(void)
+{
+    uint32_t ulNow = millis();
+
+    // no polling during bus discovery
+    if ((eDiscState == DS_SWEEP) || (eDiscState == DS_FINGERPRINT))
+        DiscoverySchedule();
+    else
+        PollSchedule(ulNow);
+
+    for (;;)
+    {
+        int iPrio = MBQ.Peek(ulNow, QueueDrop);
+        if (iPrio < 0)
+            break;      // nothing queued
+
+        // discovery probes are pipelined, but not behind requests with another timeout
+        if (iPrio == PRIO_DISCOVERY)
+        {
+            if ((iInFlight >= MB_DISC_INFLIGHT) || (iInFlight > iDiscInFlight))
+                break;
+        }
+        else if (iInFlight >= MB_MAX_INFLIGHT)
+            break;
+
+        mb_qentry_t e;
+        MBQ.Pop(iPrio, e);
+        if (!QueueCheck(e))
+            continue;
+
+        Error err = QueueFire(e);
+        if (err != SUCCESS)
+        {
+            ModbusError me(err);
+            debugD("Error creating request: %02X - %s", (int)me, (const char *)me);
+            QueueDrop(e);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief end of a poll round: spread between first and last power block read of all meters
+ *        has to be called with MBaccess locked
+ */
+static void AlignRoundDone(void)
+{
+    if (iRoundReads < 2)
+        return;     // a single meter has no spread
+    uint32_t ulSpread = (uint32_t)(llRoundLast - llRoundFirst);
+    AlignStats.ulLast = ulSpread;
+    if (ulSpread > AlignStats.ulMax)
+        AlignStats.ulMax = ulSpread;
+    if (AlignStats.ulRounds == 0)
+        AlignStats.ulAvg = ulSpread;
+    else
+        AlignStats.ulAvg = (int32_t)AlignStats.ulAvg + ((int32_t)ulSpread - (int32_t)AlignStats.ulAvg) / 16;
+    AlignStats.ulRounds++;
+}
+
+/**
+ * @brief power block read of a meter: a read more than half a poll interval after the first of the round starts the next round
+ *        has to be called with MBaccess locked
+ * 
+ * @param llTime        acquisition time [us since boot]
+ * @param ulInterval    poll interval of the power block [ms]
+ */
+static void AlignSample(int64_t llTime, uint32_t ulInterval)
+{
+    if ((iRoundReads > 0) && (llTime - llRoundFirst < (int64_t)ulInterval * 500))
+    {
+        if (llTime > llRoundLast)
+            llRoundLast = llTime;
+        iRoundReads++;
+        return;
+    }
+    AlignRoundDone();
+    llRoundFirst = llTime;
+    llRoundLast = llTime;
+    iRoundReads = 1;
+}
+
+/**
+ * @brief time a finished request held the bus: from its issue or the end of the previous transaction, whichever is later
+ *        pipelined discovery probes wait in eModbus behind each other, their waiting time is not bus time
+ *        has to be called with MBaccess locked
+ * 
+ * @return uint32_t bus time [us]
+ */
+static uint32_t BusHold(const mb_reqctx_t *pCtx)
+{
+    uint32_t ulNow = micros();
+    uint32_t ulStart = ((int32_t)(ulLineFree - pCtx->ulIssueMicros) > 0) ? ulLineFree : pCtx->ulIssueMicros;
+
+    ulLineFree = ulNow;
+    return ulNow - ulStart;
+}
+
+void handleData(ModbusMessage response, uint32_t token)
+{
+    debugV("Response: serverID=%d, FC=%d, Token=%08X, length=%d:", response.getServerID(), response.getFunctionCode(), token, response.size());
+    
+    if (MB_MUTEX_LOCK())
+    {
+        if (iInFlight > 0)
+            iInFlight--;
+
+        // get request context and meter instance from token
+        mb_reqctx_t *pCtx = ReqLookup(token);
+        uint32_t ulRtt = pCtx ? micros() - pCtx->ulIssueMicros : 0;
+        uint32_t ulBusUs = pCtx ? BusHold(pCtx) : 0;
+        if (pCtx)
+            BusMetrics.Response(ulRtt, response.size() + 2, ulBusUs);
+        if (Capture.Enabled())
+            Capture.Response(response.data(), response.size());
+        if (pCtx && (pCtx->uMeter == MB_CTX_DISCOVERY))
+        {
+            if (iDiscInFlight > 0)
+                iDiscInFlight--;
+            DiscoveryResponse(*pCtx, SUCCESS);
+            ReqFree(pCtx);
+        }
+        else if (pCtx && (pCtx->uMeter == MB_CTX_BRIDGE))
+        {
+            BridgeResponse(*pCtx, SUCCESS, &response);
+            ReqFree(pCtx);
+        }
+        else if (pCtx && (pCtx->uMeter == MB_CTX_WRITE))
+        {
+            WriteResponse(*pCtx, SUCCESS, response.data(), response.size());
+            ReqFree(pCtx);
+        }
+        else if (pCtx)
+        {
+            ModBusMeter *pM = &ModMeters[pCtx->uMeter];
+
+            pM->GetMetrics().Response(ulRtt, response.size() + 2, ulBusUs);
+            if (!pM->isConnected())
+                lOfflineBudget -= ulRtt / 1000;
+            if (response.getServerID() == pM->GetDeviceAddr())
+            {
+                // request 8 bytes, response incl. CRC, 3.5 chars silence
+                pM->UpdateRtt(ulRtt, (MB_READ_REQ_BYTES + response.size() + 2) * ulCharUs + 35 * ulCharUs / 10);
+                // the device answers from the registers it holds at the end of the request frame
+                int64_t llAcquired = esp_timer_get_time() - ulRtt + (MB_READ_REQ_BYTES * ulCharUs + 35 * ulCharUs / 10);
+                pM->handleMeterData(response.data(), response.size(), *pCtx, llAcquired);
+                if ((pCtx->uBlock != MB_BLOCK_PROBE) && (pCtx->uBlock == pM->GetAlignBlock()))
+                    AlignSample(llAcquired, pM->GetBlockInterval(pCtx->uBlock));
+            }
+            ReqFree(pCtx);
+        }
+        else
+            debugD("Response with unknown token %08X", token);
+
+        MBSchedule();
+        MB_MUTEX_UNLOCK();
+    }
+}
+
+void handleError(Error error, uint32_t token) 
+{
+    if (MB_MUTEX_LOCK())
+    {
+        if (iInFlight > 0)
+            iInFlight--;
+
+        mb_reqctx_t *pCtx = ReqLookup(token);
+        uint32_t ulRtt = pCtx ? micros() - pCtx->ulIssueMicros : 0;
+        uint32_t ulBusUs = pCtx ? BusHold(pCtx) : 0;
+        if (pCtx)
+        {
+            BusMetrics.Failure(error, ulRtt, ulBusUs);
+            if (Capture.Enabled())
+                Capture.Failure(pCtx->uServer, pCtx->uFC, error);
+        }
+        if (pCtx && (pCtx->uMeter == MB_CTX_DISCOVERY))
+        {
+            if (iDiscInFlight > 0)
+                iDiscInFlight--;
+            DiscoveryResponse(*pCtx, error);
+            ReqFree(pCtx);
+        }
+        else if (pCtx && (pCtx->uMeter == MB_CTX_BRIDGE))
+        {
+            BridgeResponse(*pCtx, error, NULL);
+            ReqFree(pCtx);
+        }
+        else if (pCtx && (pCtx->uMeter == MB_CTX_WRITE))
+        {
+            WriteResponse(*pCtx, error, NULL, 0);
+            ReqFree(pCtx);
+        }
+        else if (pCtx)
+        {
+            ModBusMeter *pM = &ModMeters[pCtx->uMeter];
+
+            pM->GetMetrics().Failure(error, ulRtt, ulBusUs);
+            if (!pM->isConnected())
+                lOfflineBudget -= ulRtt / 1000;
+            pM->handleMeterError(error, *pCtx);
+            ReqFree(pCtx);
+        }
+
+        MBSchedule();
+        MB_MUTEX_UNLOCK();
+    }
+}
+
+/**
+ * @brief allocate meters and channel store
+ */
+static void SetupMeters(int iN, eMeterType *dt, uint16_t *devadr)
+{
+    if (iN > MAX_METERS)
+    {
+        debugD("StartModBus clip to max. %d devices", MAX_METERS);
+        iN = MAX_METERS;
+    }
+        
+    ModBusMeter *pMeters = new ModBusMeter[iN];
+    int iNValues = 0;
+    for (int i = 0; i<iN; i++)
+    {
+        debugD("%d: Type: %s, Addr: %d", i, pMeters[i].MeterType2Text(*dt), *devadr);
+        pMeters[i].SetMeter(*dt, *devadr, i);
+        iNValues += pMeters[i].GetNumberOfChannels();
+        ++dt;
+        ++devadr;
+    }
+
+    // channel store: only the channels each meter type provides, working and published copy, last reported values
+    mb_value_t *pvWork = new mb_value_t[iNValues]();
+    mb_value_t *pvPublic = new mb_value_t[iNValues]();
+    mb_value_t *pvRef = new mb_value_t[iNValues];
+    for (int i = 0; i<iNValues; i++)
+        pvRef[i] = MB_VALUE_NONE;   // first value is a change
+    for (int i = 0, iOff = 0; i<iN; i++)
+    {
+        pMeters[i].SetChannelStore(pvWork + iOff, pvPublic + iOff, pvRef + iOff);
+        iOff += pMeters[i].GetNumberOfChannels();
+    }
+    debugD("channel store: %d values", iNValues);
+
+    // shadow register images for Modbus TCP
+    int iNShadow = 0;
+    for (int i = 0; i<iN; i++)
+        iNShadow += pMeters[i].GetShadowSize();
+    uint8_t *pShadow = new uint8_t[iNShadow]();
+    for (int i = 0, iOff = 0; i<iN; i++)
+    {
+        pMeters[i].SetShadowStore(pShadow + iOff);
+        iOff += pMeters[i].GetShadowSize();
+    }
+
+    // check poll plan against bus capacity
+    float fBusTime = 0.0;
+    for (int i = 0; i<iN; i++)
+        fBusTime += pMeters[i].GetBusTime(ulBaudrate);
+    ulBusLoad = (uint32_t)(fBusTime / 10.0);
+    if (ulBusLoad > 100)
+        debugW("poll plan exceeds bus capacity: %d%% bus load", ulBusLoad);
+    else
+        debugD("estimated bus load: %d%%", ulBusLoad);
+
+    // number of meters last: readers check the index against it
+    ModMeters = pMeters;
+    pvChannelStore = pvWork;
+    pvPublicStore = pvPublic;
+    pvRefStore = pvRef;
+    pShadowStore = pShadow;
+    iNChannelValues = iNValues;
+    iNMeters = iN;
+}
+
+/**
+ * @brief prepare the ModBus communication
+ * 
+ * @param baudrate  : baudrate              (default: 9600)
+ * @param iN        : number or meters      (0..32), 0: meters are set up by StartDiscovery()
+ * @param *dt       : type of Modbus meter  (array of device types
+ * @param *devadr   : device adr            (array of device addresses
+ */
+void StartModBus(uint32_t baudrate, int iN, eMeterType *dt, uint16_t *devadr)
+{
+    debugD("StartModBus with %d devices at Baudrate %d", iN, baudrate);
+    ulBaudrate = baudrate;
+    SetupMeters(iN, dt, devadr);
+
+    // all request contexts free
+    for (int i = 0; i<MB_REQ_SLOTS; i++)
+    {
+        aReqCtx[i].fUsed = false;
+        auReqFree[i] = MB_REQ_SLOTS - 1 - i;
+    }
+    iReqFree = MB_REQ_SLOTS;
+
+    MBQ.SetDepth(PRIO_CONTROL, MB_QUEUE_CONTROL);
+    MBQ.SetDepth(PRIO_INTERACTIVE, MB_BRIDGE_JOBS);
+    MBQ.SetDepth(PRIO_POLL, MB_QUEUE_POLL);
+    MBQ.SetDepth(PRIO_DISCOVERY, MB_DISC_INFLIGHT);
+
+    for (int i = 0; i<MB_BRIDGE_JOBS; i++)
+    {
+        aBridge[i].eState = BJ_FREE;
+        aBridge[i].hDone = xSemaphoreCreateCounting(MB_BRIDGE_WAITERS, 0);
+        assert(aBridge[i].hDone != NULL);
+    }
+
+    ulOfflineRefill = millis();
+    ulUtilStart = millis();
+    ulAlignEpoch = millis();
+    MBaccess = xSemaphoreCreateMutex();
+    assert(MBaccess != NULL);
+
+    // Set up Serial2 connected to Modbus RTU
+    // ttgo lora pins for Serial2 => RX pin 35, TX pin 13, pin 17: RTS (Rx/Tx switch)
+    pinMode(17, OUTPUT);
+    // SDM support 8Bit, 1 stop, no parity
+    Serial2.begin(baudrate, SERIAL_8N1, 35, 13);
+    
+    // Set up ModbusRTU client.
+    // - provide onData handler function
+    MB.onDataHandler(&handleData);
+    // - provide onError handler function
+    MB.onErrorHandler(&handleError);
+    // Set message timeout, adapted per device before each request
+    MB.setTimeout(MB_TIMEOUT_INIT);
+    // 8N1: 10 bits per character
+    ulCharUs = 10 * 1000000L / baudrate;
+    // Start ModbusRTU background task
+    MB.begin();
+
+    // connect requests are started by scheduler
+} 
+
+/**
+ * @brief Loop function for Modbus
+ *        hand due block reads to eModbus, further reads are started from the response handlers
+ * 
+ */
+void ModBusHandle(void)
+{
+    if (MBaccess && MB_MUTEX_LOCK())
+    {
+        if (eDiscState == DS_DONE)
+        {
+            // set up discovered meters, report them outside of lock
+            // discovery only runs without meters: no reader holds a meter pointer
+            eDiscState = DS_IDLE;
+            delete [] ModMeters;
+            delete [] pvChannelStore;
+            delete [] pvPublicStore;
+            delete [] pvRefStore;
+            delete [] pShadowStore;
+            SetupMeters(iDiscFound, aeDiscType, auDiscAddr);
+            MB_MUTEX_UNLOCK();
+            if (pfnDiscDone)
+                pfnDiscDone(iDiscFound, aeDiscType, auDiscAddr);
+            return;
+        }
+        MBSchedule();
+
+        // busy time of the 32 bit counters into the 64 bit totals
+        BusMetrics.Fold();
+        for (int i = 0; i<iNMeters; i++)
+            ModMeters[i].GetMetrics().Fold();
+
+        // bus utilization: busy time in last window
+        uint32_t ulNow = millis();
+        if (ulNow - ulUtilStart >= MB_UTIL_WINDOW)
+        {
+            mb_metrics_t m;
+            BusMetrics.Get(m);
+            ulBusUtil = (uint32_t)((m.ullBusyUs - ullUtilBusyUs) / ((ulNow - ulUtilStart) * 10));
+            ullUtilBusyUs = m.ullBusyUs;
+            ulUtilStart = ulNow;
+        }
+        MB_MUTEX_UNLOCK();
     }
 } 
 
+/**
+ * @brief start a discovery of all meters on the bus
+ *        only without configured meters: the meters found are set up and polled afterwards
+ * 
+ * @param pfnDone   called from ModBusHandle() with the meters found, e.g. to store them
+ * @return true     discovery started
+ */
+bool StartDiscovery(mb_discovery_cb_t pfnDone)
+{
+    bool fStarted = false;
+
+    if (MBaccess && MB_MUTEX_LOCK())
+    {
+        if ((iNMeters == 0) && (eDiscState == DS_IDLE))
+        {
+            debugI("discovery: start sweep of address %d..%d", MB_ADDR_MIN, MB_ADDR_MAX);
+            memset(aulDiscAlive, 0, sizeof(aulDiscAlive));
+            iDiscFound = 0;
+            iDiscAddr = MB_ADDR_MIN;
+            iDiscTest = 0;
+            pfnDiscDone = pfnDone;
+            eDiscState = DS_SWEEP;
+            fStarted = true;
+        }
+        MB_MUTEX_UNLOCK();
+    }
+    return fStarted;
+}
+
+/**
+ * @brief read registers of a device through the RTU bus for a TCP client
+ *        blocks the calling client task until the response arrives.
+ *        The same read of several clients is done once, overlapping reads are merged,
+ *        clients get a fair share, reads go before polls.
+ * 
+ * @param pClient   identifies the client, e.g. its task handle
+ * @param uServer   device address
+ * @param uFC       function code (READ_HOLD_REGISTER, READ_INPUT_REGISTER)
+ * @param uAddr     first register
+ * @param uWords    # of registers
+ * @param pDst      [out] register values, big endian
+ * @param ulTimeout max. wait [ms]
+ * @return Error    SUCCESS, exception of device or error
+ */
+Error BridgeRead(void *pClient, uint8_t uServer, uint8_t uFC, uint16_t uAddr, uint16_t uWords, uint8_t *pDst, uint32_t ulTimeout)
+{
+    if ((uWords == 0) || (uWords > MB_MAX_BLOCK_WORDS))
+        return ILLEGAL_DATA_VALUE;
+    if ((MBaccess == NULL) || !MB_MUTEX_LOCK())
+        return GATEWAY_PATH_UNAVAIL;
+
+    mb_bridgejob_t *pJ = BridgeJoin(pClient, uServer, uFC, uAddr, uWords, ulTimeout);
+    if (pJ == NULL)
+    {
+        MB_MUTEX_UNLOCK();
+        return SERVER_DEVICE_BUSY;
+    }
+    pJ->iWaiters++;
+    MBSchedule();       // bus may be idle
+    MB_MUTEX_UNLOCK();
+
+    xSemaphoreTake(pJ->hDone, pdMS_TO_TICKS(ulTimeout));
+
+    Error err = GATEWAY_TARGET_NO_RESP;
+    if (MB_MUTEX_LOCK())
+    {
+        if (pJ->eState == BJ_DONE)
+        {
+            err = pJ->err;
+            if (err == SUCCESS)
+                memcpy(pDst, pJ->abData + 2 * (uAddr - pJ->uAddr), 2 * uWords);
+        }
+        // last waiter frees transaction, a queued one is not needed any more
+        if ((--pJ->iWaiters == 0) && ((pJ->eState == BJ_DONE) || (pJ->eState == BJ_QUEUED)))
+            BridgeFree(pJ);
+        MB_MUTEX_UNLOCK();
+    }
+    return err;
+}
+
+/**
+ * @brief write holding registers of a device, at the highest priority before all reads
+ *        adjacent registers are batched into one FC16 request (FC06 for a single register),
+ *        with fVerify each request is read back with FC03 and compared.
+ *        Returns at once, the result is polled with GetWriteResult().
+ * 
+ * @param iServer   device address, MB_ADDR_MIN..MB_ADDR_MAX
+ * @param pRegs     registers and values, any order
+ * @param iN        # of registers, max. MB_WRITE_MAX_REGS
+ * @param fVerify   read back written registers
+ * @return int      job id, < 0: invalid registers or all jobs busy
+ */
+int WriteRegisters(int iServer, const mb_wreg_t *pRegs, int iN, bool fVerify)
+{
+    if ((iN <= 0) || (iN > MB_WRITE_MAX_REGS) || (iServer < MB_ADDR_MIN) || (iServer > MB_ADDR_MAX))
+        return -1;
+    uint8_t uServer = iServer;
+
+    // sort by register, a register may only be written once
+    mb_wreg_t aReg[MB_WRITE_MAX_REGS];
+    for (int i=0; i<iN; i++)
+    {
+        int j = i;
+        for (; (j > 0) && (aReg[j-1].uAddr > pRegs[i].uAddr); j--)
+            aReg[j] = aReg[j-1];
+        aReg[j] = pRegs[i];
+    }
+    for (int i=1; i<iN; i++)
+    {
+        if (aReg[i].uAddr == aReg[i-1].uAddr)
+            return -1;
+    }
+
+    if ((MBaccess == NULL) || !MB_MUTEX_LOCK())
+        return -1;
+
+    // free job or the oldest result
+    mb_writejob_t *pJ = NULL;
+    for (int i=0; i<MB_WRITE_JOBS; i++)
+    {
+        mb_writejob_t *p = &aWrite[i];
+        if (p->eState == WS_BUSY)
+            continue;
+        if ((pJ == NULL) || (p->eState == WS_UNKNOWN) || ((pJ->eState != WS_UNKNOWN) && ((int32_t)(p->ulDone - pJ->ulDone) < 0)))
+            pJ = p;
+    }
+    if ((pJ == NULL) || !MBQ.HasRoom(PRIO_CONTROL))
+    {
+        MB_MUTEX_UNLOCK();
+        return -1;
+    }
+
+    // runs of adjacent registers
+    pJ->uNRuns = 0;
+    for (int i=0; i<iN; i++)
+    {
+        mb_writerun_t *pR = (pJ->uNRuns > 0) ? &pJ->aRun[pJ->uNRuns - 1] : NULL;
+        if (pR && (aReg[i].uAddr == aReg[i-1].uAddr + 1) && (pR->uWords < MB_WRITE_RUN_WORDS))
+            pR->uWords++;
+        else if (pJ->uNRuns < MB_WRITE_MAX_RUNS)
+        {
+            pR = &pJ->aRun[pJ->uNRuns++];
+            pR->uAddr = aReg[i].uAddr;
+            pR->uFirst = i;
+            pR->uWords = 1;
+        }
+        else
+        {
+            MB_MUTEX_UNLOCK();
+            return -1;      // too scattered
+        }
+        pJ->auValue[i] = aReg[i].uValue;
+    }
+
+    pJ->eState = WS_BUSY;
+    pJ->uGen++;
+    pJ->uServer = uServer;
+    pJ->fVerify = fVerify;
+    pJ->fReading = false;
+    pJ->uRun = 0;
+    pJ->err = SUCCESS;
+    int iJob = ((int)pJ->uGen << 8) | (pJ - aWrite);
+    debugI("write job %d: %d registers in %d requests to %d", pJ - aWrite, iN, pJ->uNRuns, uServer);
+    WriteStep(pJ);
+    MBSchedule();       // bus may be idle
+    MB_MUTEX_UNLOCK();
+    return iJob;
+}
+
+/**
+ * @brief result of a write job
+ * 
+ * @param iJob      job id of WriteRegisters()
+ * @param err       [out] exception of device or transport error of WS_FAILED
+ * @param uAddr     [out] register of failure or mismatch
+ * @return eWriteState state, WS_UNKNOWN: no such job or result overwritten by a newer job
+ */
+eWriteState GetWriteResult(int iJob, Error &err, uint16_t &uAddr)
+{
+    eWriteState eState = WS_UNKNOWN;
+    int iIdx = iJob & 0xff;
+
+    err = SUCCESS;
+    uAddr = 0;
+    if ((iJob < 0) || (iIdx >= MB_WRITE_JOBS) || (MBaccess == NULL) || !MB_MUTEX_LOCK())
+        return WS_UNKNOWN;
+    mb_writejob_t *pJ = &aWrite[iIdx];
+    if (pJ->uGen == (iJob >> 8))
+    {
+        eState = pJ->eState;
+        err = pJ->err;
+        uAddr = pJ->uFailAddr;
+    }
+    MB_MUTEX_UNLOCK();
+    return eState;
+}
+
+const char *WriteState2Text(eWriteState eState)
+{
+    switch (eState)
+    {
+        case WS_BUSY:
+            return "busy";
+        case WS_DONE:
+            return "done";
+        case WS_FAILED:
+            return "failed";
+        case WS_MISMATCH:
+            return "mismatch";
+        default:
+            return "unknown";
+    }
+}
+
+/**
+ * @brief progress of bus discovery
+ * 
+ * @param iAddr     [out] address probed or identified
+ * @param iFound    [out] # of meters found
+ * @return const char* state text
+ */
+const char *GetDiscoveryState(int &iAddr, int &iFound)
+{
+    iAddr = iDiscAddr;
+    iFound = iDiscFound;
+    switch (eDiscState)
+    {
+        case DS_SWEEP:
+            return "sweep";
+        case DS_FINGERPRINT:
+            return "fingerprint";
+        case DS_DONE:
+            return "done";
+        default:
+            return "idle";
+    }
+}
+
+/**
+ * @brief clear the frame capture and start it in a new mode
+ */
+void StartCapture(eCapMode eMode)
+{
+    if (MBaccess && MB_MUTEX_LOCK())
+    {
+        debugI("frame capture mode %d", eMode);
+        Capture.Start(eMode);
+        MB_MUTEX_UNLOCK();
+    }
+}
+
+/**
+ * @brief state of frame capture
+ * 
+ * @param iRecords      [out] # of captured frames and errors
+ * @param fTriggered    [out] error seen
+ * @return eCapMode     mode
+ */
+eCapMode GetCaptureState(int &iRecords, bool &fTriggered)
+{
+    iRecords = Capture.GetRecords();
+    fTriggered = Capture.isTriggered();
+    return Capture.GetMode();
+}
+
+/**
+ * @brief pcap image of the frame capture
+ * 
+ * @param uLen      [out] size of image
+ * @return uint8_t* image, to be deleted by caller, NULL: no capture or no memory
+ */
+uint8_t *ExportCapture(size_t &uLen)
+{
+    uint8_t *pImage = NULL;
+
+    uLen = 0;
+    if (MBaccess && MB_MUTEX_LOCK())
+    {
+        size_t uSize = Capture.GetExportSize();
+        if (Capture.GetMode() != CM_OFF)
+            pImage = new (std::nothrow) uint8_t[uSize];
+        if (pImage)
+            uLen = Capture.Export(pImage, uSize);
+        MB_MUTEX_UNLOCK();
+    }
+    return pImage;
+}
+
+/**
+ * @brief estimated bus load of the poll plan in % 
+ *        > 100: poll plan exceeds bus capacity
+ */
+uint32_t GetBusLoad(void)
+{
+    return ulBusLoad;
+}
+
+/**
+ * @brief bus speed
+ */
+uint32_t GetBaudrate(void)
+{
+    return ulBaudrate;
+}
+
+/**
+ * @brief aligned polling: the power blocks of all meters are due on a common time grid 
+ *        and are sent ahead of the other blocks, the bus reads them back to back
+ * 
+ * @param fOn   aligned polling on
+ */
+void SetAlignedPolling(bool fOn)
+{
+    fAlignPolling = fOn;
+    if (MBaccess && MB_MUTEX_LOCK())
+    {
+        iRoundReads = 0;
+        memset(&AlignStats, 0, sizeof(AlignStats));
+        MB_MUTEX_UNLOCK();
+    }
+}
+
+/**
+ * @brief spread of the power block reads of all meters per poll round
+ */
+void GetAlignStats(mb_alignstats_t &s)
+{
+    memset(&s, 0, sizeof(s));
+    if (MBaccess && MB_MUTEX_LOCK())
+    {
+        s = AlignStats;
+        MB_MUTEX_UNLOCK();
+    }
+    s.fAligned = fAlignPolling;
+}
+
+/**
+ * @brief number of block reads, that missed a complete poll interval
+ */
+uint32_t GetBusOverruns(void)
+{
+    uint32_t ulOverruns = 0;
+    for (int i = 0; i<iNMeters; i++)
+        ulOverruns += ModMeters[i].GetOverruns();
+    return ulOverruns;
+}
+
+/**
+ * @brief request counters of all requests on the bus: polls, bridged reads and discovery
+ */
+void GetBusMetrics(mb_metrics_t &m)
+{
+    memset(&m, 0, sizeof(m));
+    if (MBaccess && MB_MUTEX_LOCK())
+    {
+        BusMetrics.Get(m);
+        MB_MUTEX_UNLOCK();
+    }
+}
+
+/**
+ * @brief request counters of a meter
+ * 
+ * @param idx   meter index
+ * @param m     [out] counters, all 0 for an invalid index
+ */
+void GetMeterMetrics(int idx, mb_metrics_t &m)
+{
+    memset(&m, 0, sizeof(m));
+    if (MBaccess && MB_MUTEX_LOCK())
+    {
+        if ((idx >= 0) && (idx < iNMeters))
+            ModMeters[idx].GetMetrics().Get(m);
+        MB_MUTEX_UNLOCK();
+    }
+}
+
+/**
+ * @brief measured bus utilization in % of the last MB_UTIL_WINDOW
+ */
+uint32_t GetBusUtilization(void)
+{
+    return ulBusUtil;
+}
+
+/**
+ * @brief # of requests of a class waiting for the bus
+ */
+int GetQueueDepth(eReqPrio ePrio)
+{
+    return MBQ.GetDepth(ePrio);
+}
+
+/**
+ * @brief # of requests handed to eModbus
+ */
+int GetInFlight(void)
+{
+    return iInFlight;
+}
+
 ModBusMeter *GetMeterDataPtr(int idx)
 {
-    if ( (idx >= 0) && (idx < MAX_METERS))
+    if ( (idx >= 0) && (idx < iNMeters))
         return & ModMeters[idx];
     else
         return NULL;
@@ -514,3 +2336,17 @@ int GetNumberOfMeters(void)
 {
     return iNMeters;
 }
+
+/**
+ * @brief published channel values of all meters in one array, meter by meter in meter order
+ *        layout of a meter from its register map (GetMeterMap()->pLayout)
+ *        values of one meter may be from different cycles, use ModBusMeter::GetSnapshot() for a consistent copy
+ * 
+ * @param iNValues  [out] # of values
+ * @return const mb_value_t* values, NULL: modbus not started
+ */
+const mb_value_t *GetChannelStore(int &iNValues)
+{
+    iNValues = iNChannelValues;
+    return pvPublicStore;
+}
@@ -0,0 +1,88 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	payload.cpp
+*
+* @brief:	LoRaWAN uplink payload of a meter
+* @author:	Dierk Arp
+* @date:	20261016 16:40:07
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+#include <string.h>
+#include "payload.h"
+
+/**
+ * @brief pack the last published cycle of a meter into an uplink payload (port 1):
+ *        energy in [kWh], energy out [kWh] and power of phase 1 [W] as little endian floats
+ * 
+ * @param pM    meter
+ * @param pBuf  payload buffer
+ * @param iSize size of buffer
+ * @return int  length of payload, 0: buffer too small
+ */
+int PackMeterPayload(ModBusMeter *pM, uint8_t *pBuf, int iSize)
+{
+    if (iSize < (int)PAYLOAD_METER_SIZE)
+        return 0;
+
+    mb_snapshot_t snap;
+    pM->GetSnapshot(snap);
+    // payload format is float for both channel representations
+    float afValue[3] = { ValueToFloat(CH_ENERGY_IN, snap.avChannel[CH_ENERGY_IN]),
+                         ValueToFloat(CH_ENERGY_OUT, snap.avChannel[CH_ENERGY_OUT]),
+                         ValueToFloat(CH_POWER_1, snap.avChannel[CH_POWER_1]) };
+    memcpy(pBuf, afValue, sizeof(afValue));
+    return PAYLOAD_METER_SIZE;
+}
+
+/**
+ * @brief unpack a register write downlink (port PAYLOAD_WRITE_PORT):
+ *        device address, flags (PAYLOAD_WRITE_VERIFY), then register and value of each write, 16 bit big endian
+ * 
+ * @param pBuf      payload
+ * @param iLen      length of payload
+ * @param uServer   [out] device address
+ * @param fVerify   [out] read back registers
+ * @param pRegs     [out] registers and values
+ * @param iMax      size of pRegs
+ * @return int      # of registers, < 0: invalid payload
+ */
+int UnpackWriteDownlink(const uint8_t *pBuf, int iLen, uint8_t &uServer, bool &fVerify, mb_wreg_t *pRegs, int iMax)
+{
+    if ((iLen < 6) || ((iLen - 2) % 4) || ((iLen - 2) / 4 > iMax))
+        return -1;
+
+    uServer = pBuf[0];
+    fVerify = (pBuf[1] & PAYLOAD_WRITE_VERIFY) != 0;
+    int iN = (iLen - 2) / 4;
+    for (int i=0; i<iN; i++)
+    {
+        const uint8_t *p = &pBuf[2 + 4*i];
+        pRegs[i].uAddr = (p[0] << 8) | p[1];
+        pRegs[i].uValue = (p[2] << 8) | p[3];
+    }
+    return iN;
+}
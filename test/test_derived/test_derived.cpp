@@ -0,0 +1,197 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	test_derived.cpp
+*
+* @brief:	unit tests of the derived channels: totals, power factor, imbalance and energy estimate
+* @author:	Dierk Arp
+* @date:	20261016 22:28:20
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+//
+// native build only: pio test -e native (floats) and pio test -e native_fixed (MB_FIXED_CHANNELS)
+//
+#include <unity.h>
+#include "MBDerived.h"
+
+#define CH(ch)              (1UL << (ch))
+#define PHASES(ch)          (CH(ch) | CH(ch + 1) | CH(ch + 2))
+#define ALL_POWER           (PHASES(CH_POWER_1) | PHASES(CH_APPARENT_POWER_1) | PHASES(CH_REACTIVE_POWER_1))
+#define ENERGY              (CH(CH_ENERGY_IN) | CH(CH_ENERGY_OUT))
+
+static mb_value_t avStore[CH_COUNT];
+static const mb_chlayout_t *pLayout;
+static MBDerived Derived;
+
+static void Set(eChannel ch, float fValue)
+{
+    avStore[pLayout->auSlot[ch]] = FloatToValue(ch, fValue);
+}
+
+static void SetPower(float fP1, float fP2, float fP3)
+{
+    Set(CH_POWER_1, fP1);
+    Set(CH_POWER_2, fP2);
+    Set(CH_POWER_3, fP3);
+}
+
+static void UseMeter(eMeterType mt)
+{
+    pLayout = GetMeterMap(mt)->pLayout;
+    for (int i=0; i<CH_COUNT; i++)
+        avStore[i] = 0;
+    Derived.SetStore(avStore, pLayout);
+}
+
+static mb_derived_t Get(void)
+{
+    mb_derived_t d;
+    Derived.Get(d);
+    return d;
+}
+
+void setUp(void)
+{
+    UseMeter(MT_SDM630);
+}
+
+void tearDown(void)
+{
+}
+
+void test_totals_and_power_factor(void)
+{
+    SetPower(100.0f, 200.0f, 300.0f);
+    Set(CH_APPARENT_POWER_1, 200.0f);
+    Set(CH_APPARENT_POWER_2, 200.0f);
+    Set(CH_APPARENT_POWER_3, 600.0f);
+    Set(CH_REACTIVE_POWER_1, 10.0f);
+    Set(CH_REACTIVE_POWER_2, 20.0f);
+    Set(CH_REACTIVE_POWER_3, 30.0f);
+    Derived.Update(ALL_POWER, 1000);
+
+    mb_derived_t d = Get();
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 600.0f, d.fPowerTotal);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 1000.0f, d.fApparentTotal);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 60.0f, d.fReactiveTotal);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.5f, d.afPowerFactor[0]);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 1.0f, d.afPowerFactor[1]);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.5f, d.afPowerFactor[2]);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.6f, d.fPowerFactor);
+}
+
+void test_power_factor_limits(void)
+{
+    SetPower(300.0f, 100.0f, -300.0f);
+    Set(CH_APPARENT_POWER_1, 200.0f);       // P > S: rounding of the meter
+    Set(CH_APPARENT_POWER_2, 0.0f);         // no apparent power
+    Set(CH_APPARENT_POWER_3, 200.0f);
+    Derived.Update(ALL_POWER, 1000);
+
+    mb_derived_t d = Get();
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 1.0f, d.afPowerFactor[0]);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.0f, d.afPowerFactor[1]);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, -1.0f, d.afPowerFactor[2]);
+}
+
+void test_imbalance(void)
+{
+    Set(CH_CURRENT_1, 10.0f);
+    Set(CH_CURRENT_2, 10.0f);
+    Set(CH_CURRENT_3, 16.0f);
+    Derived.Update(PHASES(CH_CURRENT_1), 1000);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 100.0f * 4.0f / 12.0f, Get().fImbalance);
+
+    UseMeter(MT_SDM230);
+    Set(CH_CURRENT_1, 10.0f);
+    Derived.Update(CH(CH_CURRENT_1), 1000);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.0f, Get().fImbalance);
+}
+
+void test_integrate_power(void)
+{
+    // 3600 W for 1 s: 1 Wh
+    SetPower(3600.0f, 0.0f, 0.0f);
+    Derived.Update(ALL_POWER, 1000);
+    Derived.Update(ALL_POWER, 2000);
+    TEST_ASSERT_EQUAL_INT64(1000, Get().llEnergyIn);
+    TEST_ASSERT_EQUAL_INT64(0, Get().llEnergyOut);
+
+    // sign change: split at the zero crossing after 500 ms
+    SetPower(-3600.0f, 0.0f, 0.0f);
+    Derived.Update(ALL_POWER, 3000);
+    TEST_ASSERT_EQUAL_INT64(1250, Get().llEnergyIn);
+    TEST_ASSERT_EQUAL_INT64(250, Get().llEnergyOut);
+
+    // gap in data: not integrated
+    Derived.Update(ALL_POWER, 3000 + MBD_MAX_GAP_MS + 1);
+    TEST_ASSERT_EQUAL_INT64(250, Get().llEnergyOut);
+}
+
+void test_energy_corrected_by_counter(void)
+{
+    TEST_ASSERT_FALSE(Get().fEnergyValid);
+
+    // first counter read sets the estimate
+    Set(CH_ENERGY_IN, 10.0f);
+    Set(CH_ENERGY_OUT, 2.0f);
+    Derived.Update(ENERGY, 0);
+    mb_derived_t d = Get();
+    TEST_ASSERT_TRUE(d.fEnergyValid);
+    TEST_ASSERT_EQUAL_INT64(10000000, d.llEnergyIn);
+    TEST_ASSERT_EQUAL_INT64(2000000, d.llEnergyOut);
+    TEST_ASSERT_EQUAL_INT32(0, d.lCorrection);
+
+    // 3600 W for 11 s: 11 Wh, more than one step of the counter
+    SetPower(3600.0f, 0.0f, 0.0f);
+    for (uint32_t t=0; t<=11000; t+=1000)
+        Derived.Update(ALL_POWER, t);
+    TEST_ASSERT_EQUAL_INT64(10011000, Get().llEnergyIn);
+
+    // counter unchanged: estimate pulled back into its resolution interval
+    Derived.Update(ENERGY, 11000);
+    d = Get();
+    TEST_ASSERT_EQUAL_INT64(10000000 + MBD_COUNTER_RES_MWH - 1, d.llEnergyIn);
+    TEST_ASSERT_EQUAL_INT32(-1001, d.lCorrection);
+
+    // counter ahead of estimate: estimate raised to the counter
+    Set(CH_ENERGY_IN, 10.02f);
+    Derived.Update(ENERGY, 11000);
+    d = Get();
+    TEST_ASSERT_EQUAL_INT64(10020000, d.llEnergyIn);
+    TEST_ASSERT_EQUAL_INT32(10020000 - 10009999, d.lCorrection);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_totals_and_power_factor);
+    RUN_TEST(test_power_factor_limits);
+    RUN_TEST(test_imbalance);
+    RUN_TEST(test_integrate_power);
+    RUN_TEST(test_energy_corrected_by_counter);
+    return UNITY_END();
+}
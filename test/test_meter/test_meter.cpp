@@ -0,0 +1,154 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	test_meter.cpp
+*
+* @brief:	unit tests of the meter polling: connect request and decoding of block reads
+* @author:	Dierk Arp
+* @date:	20261016 22:41:28
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+//
+// native build only: pio test -e native (floats) and pio test -e native_fixed (MB_FIXED_CHANNELS)
+// the eModbus shim records the requests, a simulated device answers them
+//
+#include <map>
+#include <unity.h>
+#include "modbus.h"
+#include "ModbusRegister.h"
+
+extern ModbusClientRTU MB;
+
+#define DEVICE              (5)         // device address
+
+static std::map<uint16_t, uint16_t> Device;     // registers of the device
+
+/**
+ * @brief answer the oldest request of a read function code like a device, returns the request
+ */
+static native_request_t Answer(void)
+{
+    TEST_ASSERT_FALSE(MB.aRequests.empty());
+    native_request_t r = MB.aRequests.front();
+    MB.aRequests.erase(MB.aRequests.begin());
+
+    ModbusMessage msg;
+    msg.add(r.uServer);
+    msg.add(r.uFC);
+    msg.add((uint8_t)(2 * r.uWords));
+    for (int i=0; i<r.uWords; i++)
+        msg.add(Device[r.uAddr + i]);
+    MB.pfnData(msg, r.token);
+    return r;
+}
+
+void setUp(void)
+{
+    Device.clear();
+    MB.aRequests.clear();
+}
+
+void tearDown(void)
+{
+    MB.aRequests.clear();
+}
+
+void test_unknown_meter_not_polled(void)
+{
+    eMeterType aeType[] = { MT_UNKNOWN, MT_FINDER };
+    uint16_t auAddr[] = { 3, DEVICE };
+
+    StartModBus(9600, 2, aeType, auAddr);
+    ModBusHandle();
+
+    // only the connect request of the Finder, an unknown meter has none
+    TEST_ASSERT_EQUAL(1, MB.aRequests.size());
+    native_request_t r = Answer();
+    TEST_ASSERT_EQUAL(DEVICE, r.uServer);
+    TEST_ASSERT_EQUAL(READ_HOLD_REGISTER, r.uFC);
+    TEST_ASSERT_EQUAL(FINDER_FIRMWARE_VERSION, r.uAddr);
+    TEST_ASSERT_EQUAL(1, r.uWords);
+    for (int i=0; (i<20) && !MB.aRequests.empty(); i++)
+    {
+        TEST_ASSERT_EQUAL(DEVICE, Answer().uServer);
+        ModBusHandle();
+    }
+    TEST_ASSERT_FALSE(GetMeterDataPtr(0)->isConnected());
+    TEST_ASSERT_TRUE(GetMeterDataPtr(1)->isConnected());
+}
+
+void test_finder_power_in_watts(void)
+{
+    eMeterType aeType[] = { MT_FINDER };
+    uint16_t auAddr[] = { DEVICE };
+
+    Device[FINDER_FIRMWARE_VERSION] = 12;
+    Device[FINDER_IMPORT_ACTIVE_ENERGY] = 13;       // 13 * 65536 + 60383 = 9123.51 kWh
+    Device[FINDER_IMPORT_ACTIVE_ENERGY + 1] = 60383;
+    Device[FINDER_PHASE_1_VOLTAGE] = 230;
+    Device[FINDER_PHASE_1_CURRENT] = 312;           // 31.2 A
+    Device[FINDER_PHASE_1_POWER] = 123;             // 1.23 kW
+    Device[FINDER_PHASE_1_REACTIVE_POWER] = 45;     // 0.45 kVAr
+
+    StartModBus(9600, 1, aeType, auAddr);
+    ModBusMeter *pM = GetMeterDataPtr(0);
+
+    // the energy block is read after the first cycle, published with the second one
+    uint32_t ulStart = millis();
+    while ((pM->GetCycles() < 2) && (millis() - ulStart < 3 * MB_POLL_FAST_MS))
+    {
+        ModBusHandle();
+        if (!MB.aRequests.empty())
+            Answer();
+    }
+
+    TEST_ASSERT_TRUE(pM->isConnected());
+    TEST_ASSERT_EQUAL(12, pM->GetFWVersion());
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 1230.0f, pM->GetPhasePower(0));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 450.0f, pM->GetReactivePower(0));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 31.2f, pM->GetPhaseCurrent(0));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 9123.51f, pM->GetEnergyIn());
+
+    // derived values in W, energy estimate from the counter in mWh
+    mb_snapshot_t snap;
+    pM->GetSnapshot(snap);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 1230.0f, snap.derived.fPowerTotal);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 450.0f, snap.derived.fReactiveTotal);
+    TEST_ASSERT_TRUE(snap.derived.fEnergyValid);
+    TEST_ASSERT_TRUE(snap.derived.llEnergyIn >= 9123510000LL);
+    TEST_ASSERT_TRUE(snap.derived.llEnergyIn < 9123510000LL + MBD_COUNTER_RES_MWH);
+#ifdef MB_FIXED_CHANNELS
+    TEST_ASSERT_EQUAL_INT32(1230000, snap.avChannel[CH_POWER_1]);     // mW
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_unknown_meter_not_polled);
+    RUN_TEST(test_finder_power_in_watts);
+    return UNITY_END();
+}
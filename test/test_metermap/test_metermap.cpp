@@ -0,0 +1,185 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	test_metermap.cpp
+*
+* @brief:	unit tests of the read planner, channel layouts and channel value conversion
+* @author:	Dierk Arp
+* @date:	20261016 22:28:20
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+//
+// native build only: pio test -e native (floats) and pio test -e native_fixed (MB_FIXED_CHANNELS)
+//
+#include <unity.h>
+#include "MeterMap.h"
+#include "ModbusRegister.h"
+
+#define REG(fc, addr, ch, poll)     { fc, addr, 2, DT_FLOAT, 1.0f, WO_HIGH_FIRST, ch, poll }
+
+// sorted by function code and address: one holding register, then input registers with gaps and poll classes
+static constexpr mb_regdesc_t TEST_MAP[] = 
+{
+    REG(READ_HOLD_REGISTER,  0x0000, CH_FREQUENCY, PC_FAST),        // block 0: other function code
+    REG(READ_INPUT_REGISTER, 0x0000, CH_VOLTAGE_1, PC_NORMAL),      // block 1
+    REG(READ_INPUT_REGISTER, 0x0002, CH_VOLTAGE_2, PC_NORMAL),      //          contiguous
+    REG(READ_INPUT_REGISTER, 0x000C, CH_VOLTAGE_3, PC_NORMAL),      //          gap of MB_MAX_BLOCK_GAP words is bridged
+    REG(READ_INPUT_REGISTER, 0x0017, CH_CURRENT_1, PC_NORMAL),      // block 2: gap of MB_MAX_BLOCK_GAP + 1 words
+    REG(READ_INPUT_REGISTER, 0x0019, CH_POWER_1,   PC_FAST),        // block 3: other poll class
+};
+
+static_assert(IsMapSorted(TEST_MAP), "test map not sorted");
+static constexpr auto TEST_PLAN = PlanBlocks(TEST_MAP);
+static_assert(TEST_PLAN.uNBlocks == 4, "read plan is built at compile time");
+
+static void CheckBlock(const mb_block_t &b, uint8_t uFC, uint16_t uStart, uint16_t uWords, uint8_t uFirstReg, uint8_t uNRegs, ePollClass ePoll)
+{
+    TEST_ASSERT_EQUAL_UINT8(uFC, b.uFC);
+    TEST_ASSERT_EQUAL_UINT16(uStart, b.uStart);
+    TEST_ASSERT_EQUAL_UINT16(uWords, b.uWords);
+    TEST_ASSERT_EQUAL_UINT8(uFirstReg, b.uFirstReg);
+    TEST_ASSERT_EQUAL_UINT8(uNRegs, b.uNRegs);
+    TEST_ASSERT_EQUAL_INT(ePoll, b.ePoll);
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_plan_merges_by_gap_class_and_fc(void)
+{
+    TEST_ASSERT_EQUAL_UINT8(4, TEST_PLAN.uNBlocks);
+    CheckBlock(TEST_PLAN.aBlocks[0], READ_HOLD_REGISTER, 0x0000, 2, 0, 1, PC_FAST);
+    CheckBlock(TEST_PLAN.aBlocks[1], READ_INPUT_REGISTER, 0x0000, 14, 1, 3, PC_NORMAL);
+    CheckBlock(TEST_PLAN.aBlocks[2], READ_INPUT_REGISTER, 0x0017, 2, 4, 1, PC_NORMAL);
+    CheckBlock(TEST_PLAN.aBlocks[3], READ_INPUT_REGISTER, 0x0019, 2, 5, 1, PC_FAST);
+}
+
+void test_plan_splits_at_max_block_words(void)
+{
+    mb_regdesc_t aRegs[64];
+    for (int i=0; i<64; i++)
+        aRegs[i] = REG(READ_INPUT_REGISTER, (uint16_t)(2*i), CH_VOLTAGE_1, PC_FAST);
+
+    auto plan = PlanBlocks(aRegs);
+    TEST_ASSERT_EQUAL_UINT8(2, plan.uNBlocks);
+    CheckBlock(plan.aBlocks[0], READ_INPUT_REGISTER, 0, 124, 0, 62, PC_FAST);
+    CheckBlock(plan.aBlocks[1], READ_INPUT_REGISTER, 124, 4, 62, 2, PC_FAST);
+}
+
+void test_sdm630_plan(void)
+{
+    const mb_metermap_t *pMap = GetMeterMap(MT_SDM630);
+
+    TEST_ASSERT_EQUAL_UINT8(4, pMap->uNBlocks);
+    CheckBlock(pMap->pBlocks[0], READ_INPUT_REGISTER, SDM_PHASE_1_VOLTAGE, 6, 0, 3, PC_NORMAL);
+    CheckBlock(pMap->pBlocks[1], READ_INPUT_REGISTER, SDM_PHASE_1_CURRENT, SDM_PHASE_3_REACTIVE_POWER + 2 - SDM_PHASE_1_CURRENT, 3, 12, PC_FAST);
+    CheckBlock(pMap->pBlocks[2], READ_INPUT_REGISTER, SDM_FREQUENCY, 2, 15, 1, PC_NORMAL);
+    CheckBlock(pMap->pBlocks[3], READ_INPUT_REGISTER, SDM_IMPORT_ACTIVE_ENERGY, 4, 16, 2, PC_SLOW);
+}
+
+void test_single_phase_plan(void)
+{
+    const mb_metermap_t *pMap = GetMeterMap(MT_SDM230);
+
+    // no gaps bridged: the blocks read only registers of the map
+    TEST_ASSERT_EQUAL_UINT8(7, pMap->uNBlocks);
+    CheckBlock(pMap->pBlocks[1], READ_INPUT_REGISTER, SDM_PHASE_1_CURRENT, 2, 1, 1, PC_FAST);
+    CheckBlock(pMap->pBlocks[6], READ_INPUT_REGISTER, SDM_IMPORT_ACTIVE_ENERGY, 4, 6, 2, PC_SLOW);
+    for (int i=0; i<pMap->uNBlocks; i++)
+    {
+        const mb_block_t &b = pMap->pBlocks[i];
+        uint16_t uWords = 0;
+        for (int r=b.uFirstReg; r<b.uFirstReg + b.uNRegs; r++)
+            uWords += pMap->pRegs[r].uWords;
+        TEST_ASSERT_EQUAL_UINT16(b.uWords, uWords);
+    }
+}
+
+void test_channel_layout(void)
+{
+    const mb_chlayout_t *pL = GetMeterMap(MT_SDM230)->pLayout;
+
+    TEST_ASSERT_EQUAL_UINT8(8, pL->uNChannels);
+    TEST_ASSERT_EQUAL_UINT8(0, pL->auSlot[CH_VOLTAGE_1]);
+    TEST_ASSERT_EQUAL_UINT8(1, pL->auSlot[CH_CURRENT_1]);
+    TEST_ASSERT_EQUAL_UINT8(MB_CH_NONE, pL->auSlot[CH_VOLTAGE_2]);
+    TEST_ASSERT_EQUAL_UINT8(7, pL->auSlot[CH_ENERGY_OUT]);
+    TEST_ASSERT_EQUAL_UINT8(0, GetMeterMap(MT_UNKNOWN)->pLayout->uNChannels);
+}
+
+void test_raw_to_value(void)
+{
+    const mb_metermap_t *pMap = GetMeterMap(MT_FINDER);
+    const mb_regdesc_t *pEnergy = &pMap->pRegs[0];      // U32, 0.01 kWh
+    const mb_regdesc_t *pCurrent = &pMap->pRegs[3];     // U16, 0.1 A
+
+    TEST_ASSERT_EQUAL_INT(CH_ENERGY_IN, pEnergy->eCh);
+    TEST_ASSERT_EQUAL_INT(CH_CURRENT_1, pCurrent->eCh);
+#ifdef MB_FIXED_CHANNELS
+    // exact integer arithmetic: Wh and mA
+    TEST_ASSERT_EQUAL_INT32(9123510, RawToValue(pEnergy, 912351));
+    TEST_ASSERT_EQUAL_INT32(31200, RawToValue(pCurrent, 312));
+    // beyond the range of mb_value_t: saturated, not wrapped
+    TEST_ASSERT_EQUAL_INT32(INT32_MAX, RawToValue(pEnergy, 300000000));
+    TEST_ASSERT_EQUAL_INT32(INT32_MAX, RawToValue(pEnergy, 0xFFFFFFFF));
+#else
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 9123.51f, RawToValue(pEnergy, 912351));
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 31.2f, RawToValue(pCurrent, 312));
+#endif
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 31.2f, ValueToFloat(CH_CURRENT_1, RawToValue(pCurrent, 312)));
+}
+
+void test_float_to_value(void)
+{
+    TEST_ASSERT_FLOAT_WITHIN(0.0005f, 230.125f, ValueToFloat(CH_VOLTAGE_1, FloatToValue(CH_VOLTAGE_1, 230.125f)));
+#ifdef MB_FIXED_CHANNELS
+    TEST_ASSERT_EQUAL_INT32(230125, FloatToValue(CH_VOLTAGE_1, 230.125f));
+    TEST_ASSERT_EQUAL_INT32(-1500, FloatToValue(CH_POWER_1, -1.5f));
+    TEST_ASSERT_EQUAL_INT32(0, FloatToValue(CH_POWER_1, NAN));
+    TEST_ASSERT_EQUAL_INT32(INT32_MAX, FloatToValue(CH_POWER_1, 1e9f));
+    TEST_ASSERT_EQUAL_INT32(INT32_MIN + 1, FloatToValue(CH_POWER_1, -1e9f));
+    TEST_ASSERT_FALSE(IsNoValue(FloatToValue(CH_POWER_1, -1e9f)));
+#endif
+    TEST_ASSERT_TRUE(IsNoValue(MB_VALUE_NONE));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_plan_merges_by_gap_class_and_fc);
+    RUN_TEST(test_plan_splits_at_max_block_words);
+    RUN_TEST(test_sdm630_plan);
+    RUN_TEST(test_single_phase_plan);
+    RUN_TEST(test_channel_layout);
+    RUN_TEST(test_raw_to_value);
+    RUN_TEST(test_float_to_value);
+    return UNITY_END();
+}
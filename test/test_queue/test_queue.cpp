@@ -0,0 +1,176 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	test_queue.cpp
+*
+* @brief:	unit tests of the priority request queue
+* @author:	Dierk Arp
+* @date:	20261016 22:28:20
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+//
+// native build only: pio test -e native
+//
+#include <unity.h>
+#include "MBQueue.h"
+
+static MBQueue Q;
+static int iDropped;
+static uint8_t uLastDropped;
+
+static mb_qentry_t Entry(uint8_t uBlock, uint32_t ulNow, uint32_t ulKey, uint32_t ulDeadline = 0)
+{
+    mb_qentry_t e = {};
+
+    e.ulEnqueued = ulNow;
+    e.ulKey = ulKey;
+    e.ulDeadline = ulDeadline;
+    e.fDeadline = (ulDeadline != 0);
+    e.uBlock = uBlock;
+    return e;
+}
+
+static void OnDrop(const mb_qentry_t &e)
+{
+    iDropped++;
+    uLastDropped = e.uBlock;
+}
+
+static uint8_t PopNext(uint32_t ulNow, int iExpectedPrio)
+{
+    mb_qentry_t e;
+    int iPrio = Q.Peek(ulNow, OnDrop);
+
+    TEST_ASSERT_EQUAL_INT(iExpectedPrio, iPrio);
+    Q.Pop(iPrio, e);
+    return e.uBlock;
+}
+
+void setUp(void)
+{
+    Q = MBQueue();
+    iDropped = 0;
+    uLastDropped = 0;
+}
+
+void tearDown(void)
+{
+}
+
+void test_empty(void)
+{
+    TEST_ASSERT_EQUAL_INT(-1, Q.Peek(1000, OnDrop));
+}
+
+void test_classes_in_priority_order(void)
+{
+    Q.Push(PRIO_DISCOVERY, Entry(4, 1000, 1000));
+    Q.Push(PRIO_POLL, Entry(3, 1000, 1000));
+    Q.Push(PRIO_INTERACTIVE, Entry(2, 1000, 1000));
+    Q.Push(PRIO_CONTROL, Entry(1, 1000, 1000));
+
+    TEST_ASSERT_EQUAL_UINT8(1, PopNext(1000, PRIO_CONTROL));
+    TEST_ASSERT_EQUAL_UINT8(2, PopNext(1000, PRIO_INTERACTIVE));
+    TEST_ASSERT_EQUAL_UINT8(3, PopNext(1000, PRIO_POLL));
+    TEST_ASSERT_EQUAL_UINT8(4, PopNext(1000, PRIO_DISCOVERY));
+    TEST_ASSERT_EQUAL_INT(-1, Q.Peek(1000, OnDrop));
+}
+
+void test_lowest_key_first_with_wrap(void)
+{
+    // earliest deadline first, keys compared across the wrap of millis()
+    Q.Push(PRIO_POLL, Entry(1, 0, 0x00000010));
+    Q.Push(PRIO_POLL, Entry(2, 0, 0xfffffff0));
+    Q.Push(PRIO_POLL, Entry(3, 0, 0x00000001));
+
+    TEST_ASSERT_EQUAL_UINT8(2, PopNext(0, PRIO_POLL));
+    TEST_ASSERT_EQUAL_UINT8(3, PopNext(0, PRIO_POLL));
+    TEST_ASSERT_EQUAL_UINT8(1, PopNext(0, PRIO_POLL));
+}
+
+void test_depth_limit(void)
+{
+    Q.SetDepth(PRIO_CONTROL, 2);
+    TEST_ASSERT_TRUE(Q.Push(PRIO_CONTROL, Entry(1, 0, 0)));
+    TEST_ASSERT_TRUE(Q.Push(PRIO_CONTROL, Entry(2, 0, 0)));
+    TEST_ASSERT_FALSE(Q.HasRoom(PRIO_CONTROL));
+    TEST_ASSERT_FALSE(Q.Push(PRIO_CONTROL, Entry(3, 0, 0)));
+    TEST_ASSERT_EQUAL_UINT8(2, Q.GetDepth(PRIO_CONTROL));
+    TEST_ASSERT_TRUE(Q.HasRoom(PRIO_POLL));
+}
+
+void test_aging_prevents_starvation(void)
+{
+    // a poll waiting MBQ_AGING_MS is as urgent as a new interactive read, longer: it goes first
+    Q.Push(PRIO_POLL, Entry(1, 1000, 1000));
+    Q.Push(PRIO_INTERACTIVE, Entry(2, 1000 + MBQ_AGING_MS - 1, 0));
+    TEST_ASSERT_EQUAL_UINT8(2, PopNext(1000 + MBQ_AGING_MS - 1, PRIO_INTERACTIVE));
+
+    Q.Push(PRIO_INTERACTIVE, Entry(2, 1000 + MBQ_AGING_MS + 1, 0));
+    TEST_ASSERT_EQUAL_UINT8(1, PopNext(1000 + MBQ_AGING_MS + 1, PRIO_POLL));
+}
+
+void test_deadline_drops(void)
+{
+    Q.Push(PRIO_POLL, Entry(1, 0, 0, 500));
+    Q.Push(PRIO_POLL, Entry(2, 0, 1, 2000));
+    Q.Push(PRIO_POLL, Entry(3, 0, 2));         // no deadline
+
+    TEST_ASSERT_EQUAL_UINT8(1, PopNext(499, PRIO_POLL));
+    Q.Push(PRIO_POLL, Entry(1, 0, 0, 500));
+    TEST_ASSERT_EQUAL_UINT8(2, PopNext(500, PRIO_POLL));
+    TEST_ASSERT_EQUAL_INT(1, iDropped);
+    TEST_ASSERT_EQUAL_UINT8(1, uLastDropped);
+    TEST_ASSERT_EQUAL_UINT32(1, Q.GetDropped(PRIO_POLL));
+    TEST_ASSERT_EQUAL_UINT8(3, PopNext(100000, PRIO_POLL));
+    TEST_ASSERT_EQUAL_INT(1, iDropped);
+}
+
+void test_remove(void)
+{
+    mb_qentry_t e = Entry(5, 0, 0);
+    e.uMeter = 7;
+    Q.Push(PRIO_INTERACTIVE, e);
+    Q.Push(PRIO_INTERACTIVE, Entry(6, 0, 1));
+
+    TEST_ASSERT_FALSE(Q.Remove(PRIO_INTERACTIVE, 7, 6));
+    TEST_ASSERT_TRUE(Q.Remove(PRIO_INTERACTIVE, 7, 5));
+    TEST_ASSERT_EQUAL_UINT8(1, Q.GetDepth(PRIO_INTERACTIVE));
+    TEST_ASSERT_EQUAL_UINT8(6, PopNext(0, PRIO_INTERACTIVE));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_empty);
+    RUN_TEST(test_classes_in_priority_order);
+    RUN_TEST(test_lowest_key_first_with_wrap);
+    RUN_TEST(test_depth_limit);
+    RUN_TEST(test_aging_prevents_starvation);
+    RUN_TEST(test_deadline_drops);
+    RUN_TEST(test_remove);
+    return UNITY_END();
+}
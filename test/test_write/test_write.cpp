@@ -0,0 +1,248 @@
+/**
+**********************************************************************************************************************************************************************************************************************************
+* @file:	test_write.cpp
+*
+* @brief:	unit tests of the register writes: batching, read back, job states and LoRaWAN downlink
+* @author:	Dierk Arp
+* @date:	20261016 22:33:03
+* @version:	1.0
+*
+* @copyright:	(c)2021 Team HAHIS
+*
+* MIT License
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+**********************************************************************************************************************************************************************************************************************************
+**/
+//
+// native build only: pio test -e native
+// the eModbus shim records the requests, a simulated device answers them
+//
+#include <map>
+#include <unity.h>
+#include "modbus.h"
+#include "payload.h"
+
+extern ModbusClientRTU MB;
+
+#define DEVICE              (5)         // device address
+
+static std::map<uint16_t, uint16_t> Device;     // holding registers of the device
+static int iStuck = -1;                         // register the device does not store, -1: none
+
+static void Store(uint16_t uAddr, uint16_t uValue)
+{
+    if (uAddr != iStuck)
+        Device[uAddr] = uValue;
+}
+
+/**
+ * @brief answer the oldest request like a device, returns the request
+ */
+static native_request_t Answer(void)
+{
+    TEST_ASSERT_FALSE(MB.aRequests.empty());
+    native_request_t r = MB.aRequests.front();
+    MB.aRequests.erase(MB.aRequests.begin());
+
+    ModbusMessage msg;
+    msg.add(r.uServer);
+    msg.add(r.uFC);
+    switch (r.uFC)
+    {
+        case WRITE_HOLD_REGISTER:           // uWords is the value
+            Store(r.uAddr, r.uWords);
+            msg.add(r.uAddr);
+            msg.add(r.uWords);
+            break;
+        case WRITE_MULT_REGISTERS:
+            TEST_ASSERT_EQUAL(r.uWords, MB.aWritten.size());
+            for (int i=0; i<r.uWords; i++)
+                Store(r.uAddr + i, MB.aWritten[i]);
+            msg.add(r.uAddr);
+            msg.add(r.uWords);
+            break;
+        default:
+            msg.add((uint8_t)(2 * r.uWords));
+            for (int i=0; i<r.uWords; i++)
+                msg.add(Device[r.uAddr + i]);
+            break;
+    }
+    MB.pfnData(msg, r.token);
+    return r;
+}
+
+static eWriteState State(int iJob, Error &err, uint16_t &uAddr)
+{
+    return GetWriteResult(iJob, err, uAddr);
+}
+
+void setUp(void)
+{
+    Device.clear();
+    iStuck = -1;
+    MB.aRequests.clear();
+}
+
+void tearDown(void)
+{
+    TEST_ASSERT_TRUE(MB.aRequests.empty());
+}
+
+void test_batching(void)
+{
+    const mb_wreg_t aRegs[] = { { 20, 7 }, { 11, 2 }, { 10, 1 }, { 12, 3 } };
+    Error err;
+    uint16_t uAddr;
+
+    int iJob = WriteRegisters(DEVICE, aRegs, 4, false);
+    TEST_ASSERT_TRUE(iJob >= 0);
+    TEST_ASSERT_EQUAL(WS_BUSY, State(iJob, err, uAddr));
+
+    // adjacent registers in one FC16 request, sorted
+    native_request_t r = Answer();
+    TEST_ASSERT_EQUAL(DEVICE, r.uServer);
+    TEST_ASSERT_EQUAL(WRITE_MULT_REGISTERS, r.uFC);
+    TEST_ASSERT_EQUAL(10, r.uAddr);
+    TEST_ASSERT_EQUAL(3, r.uWords);
+    TEST_ASSERT_EQUAL(WS_BUSY, State(iJob, err, uAddr));
+
+    // single register by FC06
+    r = Answer();
+    TEST_ASSERT_EQUAL(WRITE_HOLD_REGISTER, r.uFC);
+    TEST_ASSERT_EQUAL(20, r.uAddr);
+    TEST_ASSERT_EQUAL(7, r.uWords);
+
+    TEST_ASSERT_EQUAL(WS_DONE, State(iJob, err, uAddr));
+    TEST_ASSERT_EQUAL(1, Device[10]);
+    TEST_ASSERT_EQUAL(2, Device[11]);
+    TEST_ASSERT_EQUAL(3, Device[12]);
+    TEST_ASSERT_EQUAL(7, Device[20]);
+}
+
+void test_verify(void)
+{
+    const mb_wreg_t aRegs[] = { { 5, 0x1234 }, { 6, 0x5678 } };
+    Error err;
+    uint16_t uAddr;
+
+    int iJob = WriteRegisters(DEVICE, aRegs, 2, true);
+    TEST_ASSERT_TRUE(iJob >= 0);
+    TEST_ASSERT_EQUAL(WRITE_MULT_REGISTERS, Answer().uFC);
+
+    // read back of the same registers by FC03
+    native_request_t r = Answer();
+    TEST_ASSERT_EQUAL(READ_HOLD_REGISTER, r.uFC);
+    TEST_ASSERT_EQUAL(5, r.uAddr);
+    TEST_ASSERT_EQUAL(2, r.uWords);
+    TEST_ASSERT_EQUAL(WS_DONE, State(iJob, err, uAddr));
+}
+
+void test_mismatch(void)
+{
+    const mb_wreg_t aRegs[] = { { 5, 0x1234 }, { 6, 0x5678 } };
+    Error err;
+    uint16_t uAddr;
+
+    iStuck = 6;
+    int iJob = WriteRegisters(DEVICE, aRegs, 2, true);
+    Answer();
+    Answer();
+    TEST_ASSERT_EQUAL(WS_MISMATCH, State(iJob, err, uAddr));
+    TEST_ASSERT_EQUAL(SUCCESS, err);
+    TEST_ASSERT_EQUAL(6, uAddr);
+}
+
+void test_exception(void)
+{
+    const mb_wreg_t aRegs[] = { { 1, 1 }, { 40, 2 } };
+    Error err;
+    uint16_t uAddr;
+
+    int iJob = WriteRegisters(DEVICE, aRegs, 2, false);
+    Answer();
+
+    // exception of the device ends the job, the second run is not sent
+    native_request_t r = MB.aRequests.front();
+    MB.aRequests.clear();
+    TEST_ASSERT_EQUAL(40, r.uAddr);
+    MB.pfnError(ILLEGAL_DATA_ADDRESS, r.token);
+    TEST_ASSERT_EQUAL(WS_FAILED, State(iJob, err, uAddr));
+    TEST_ASSERT_EQUAL(ILLEGAL_DATA_ADDRESS, err);
+    TEST_ASSERT_EQUAL(40, uAddr);
+}
+
+void test_rejected(void)
+{
+    const mb_wreg_t aRegs[] = { { 1, 1 }, { 1, 2 } };
+    mb_wreg_t aScattered[MB_WRITE_MAX_REGS];
+    Error err;
+    uint16_t uAddr;
+
+    TEST_ASSERT_EQUAL(-1, WriteRegisters(0, aRegs, 1, false));
+    TEST_ASSERT_EQUAL(-1, WriteRegisters(248, aRegs, 1, false));
+    TEST_ASSERT_EQUAL(-1, WriteRegisters(256 + DEVICE, aRegs, 1, false));
+    TEST_ASSERT_EQUAL(-1, WriteRegisters(-1, aRegs, 1, false));
+    TEST_ASSERT_EQUAL(-1, WriteRegisters(DEVICE, aRegs, 0, false));
+    TEST_ASSERT_EQUAL(-1, WriteRegisters(DEVICE, aRegs, 2, false));        // register twice
+
+    for (int i=0; i<MB_WRITE_MAX_REGS; i++)
+    {
+        aScattered[i].uAddr = 2 * i;
+        aScattered[i].uValue = i;
+    }
+    TEST_ASSERT_EQUAL(-1, WriteRegisters(DEVICE, aScattered, MB_WRITE_MAX_REGS, false));
+    TEST_ASSERT_EQUAL(WS_UNKNOWN, State(-1, err, uAddr));
+    TEST_ASSERT_EQUAL(WS_UNKNOWN, State(0x7f00, err, uAddr));
+}
+
+void test_unpack_downlink(void)
+{
+    const uint8_t abWrite[] = { DEVICE, PAYLOAD_WRITE_VERIFY, 0x00, 0x0a, 0x12, 0x34, 0x01, 0x00, 0x00, 0x01 };
+    mb_wreg_t aRegs[2];
+    uint8_t uServer;
+    bool fVerify;
+
+    TEST_ASSERT_EQUAL(2, UnpackWriteDownlink(abWrite, sizeof(abWrite), uServer, fVerify, aRegs, 2));
+    TEST_ASSERT_EQUAL(DEVICE, uServer);
+    TEST_ASSERT_TRUE(fVerify);
+    TEST_ASSERT_EQUAL(10, aRegs[0].uAddr);
+    TEST_ASSERT_EQUAL(0x1234, aRegs[0].uValue);
+    TEST_ASSERT_EQUAL(256, aRegs[1].uAddr);
+    TEST_ASSERT_EQUAL(1, aRegs[1].uValue);
+
+    TEST_ASSERT_EQUAL(-1, UnpackWriteDownlink(abWrite, 2, uServer, fVerify, aRegs, 2));     // no register
+    TEST_ASSERT_EQUAL(-1, UnpackWriteDownlink(abWrite, 8, uServer, fVerify, aRegs, 2));     // incomplete
+    TEST_ASSERT_EQUAL(-1, UnpackWriteDownlink(abWrite, sizeof(abWrite), uServer, fVerify, aRegs, 1));
+}
+
+int main(int argc, char **argv)
+{
+    StartModBus(9600, 0, NULL, NULL);       // no meters: the bus is free for writes
+
+    UNITY_BEGIN();
+    RUN_TEST(test_batching);
+    RUN_TEST(test_verify);
+    RUN_TEST(test_mismatch);
+    RUN_TEST(test_exception);
+    RUN_TEST(test_rejected);
+    RUN_TEST(test_unpack_downlink);
+    return UNITY_END();
+}
@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+""" Latency analysis of a Modbus frame capture of the gateway (GET /api/capture) """
+#
+#  mbcapture.py - pairs requests and responses of a capture and prints the response times per device
+#
+#  usage: mbcapture.py modbus.pcap [-l]
+#     -l  list all transactions
+#
+#  Wireshark: link type USER0 (DLT 147), payload protocol mbrtu, header size 2
+#
+#  MIT License, (c)2021 Team HAHIS
+#
+
+import struct
+import sys
+
+LINKTYPE_USER0 = 147
+CR_REQUEST, CR_RESPONSE, CR_ERROR = 0, 1, 2
+ERRORS = {0xE0: 'timeout', 0xE2: 'crc'}
+
+
+def read_pcap(path):
+    """ yield (time [s], type, error code, frame) of all records """
+    with open(path, 'rb') as f:
+        data = f.read()
+    magic = struct.unpack_from('<I', data, 0)[0]
+    endian = '<' if magic == 0xa1b2c3d4 else '>'
+    linktype = struct.unpack_from(endian + 'I', data, 20)[0]
+    if linktype != LINKTYPE_USER0:
+        raise ValueError('link type %d, expected %d' % (linktype, LINKTYPE_USER0))
+    pos = 24
+    while pos + 16 <= len(data):
+        sec, usec, incl, _ = struct.unpack_from(endian + 'IIII', data, pos)
+        pos += 16
+        packet = data[pos:pos + incl]
+        pos += incl
+        yield sec + usec / 1e6, packet[0], packet[1], packet[2:]
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def count(dev, result):
+    dev['errors'][result] = dev['errors'].get(result, 0) + 1
+
+
+def analyze(path, listing):
+    devices = {}
+    pending = {}        # request by device id, discovery probes overlap
+    for t, typ, err, frame in read_pcap(path):
+        dev = devices.setdefault(frame[0], {'rtt': [], 'errors': {}})
+        if typ == CR_REQUEST:
+            if frame[0] in pending:
+                count(dev, 'unanswered')
+            pending[frame[0]] = (t, frame[1])
+            continue
+        if frame[0] not in pending:
+            continue
+        start, fc = pending.pop(frame[0])
+        rtt = (t - start) * 1000.0
+        if typ == CR_RESPONSE:
+            dev['rtt'].append(rtt)
+            result = 'exception %02X' % err if frame[1] & 0x80 else 'ok'
+        else:
+            result = ERRORS.get(err, 'error %02X' % err)
+        if result != 'ok':
+            count(dev, result)
+        if listing:
+            print('%12.6f  id %3d  fc %02X  %8.2f ms  %s' % (start, frame[0], fc, rtt, result))
+
+    print('  id  responses   min ms   avg ms   p50 ms   p99 ms   max ms  errors')
+    for addr in sorted(devices):
+        if not devices[addr]['rtt'] and not devices[addr]['errors']:
+            continue
+        rtt = devices[addr]['rtt']
+        errors = ', '.join('%s %d' % e for e in sorted(devices[addr]['errors'].items()))
+        if rtt:
+            print('%4d %10d %8.2f %8.2f %8.2f %8.2f %8.2f  %s' % (addr, len(rtt), min(rtt), sum(rtt) / len(rtt),
+                  percentile(rtt, 50), percentile(rtt, 99), max(rtt), errors))
+        else:
+            print('%4d %10d %8s %8s %8s %8s %8s  %s' % (addr, 0, '-', '-', '-', '-', '-', errors))
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 2:
+        print(__doc__)
+        print('usage: %s modbus.pcap [-l]' % sys.argv[0])
+        sys.exit(1)
+    analyze(sys.argv[1], '-l' in sys.argv[2:])
@@ -0,0 +1,474 @@
+#!/usr/bin/env python3
+""" Bus timing model of the gateway: does a mix of meters fit on one RTU bus? """
+#
+#  mbplan.py - discrete event model of the poll scheduler and the RTU frame times
+#
+#  The read plans are built from the register maps in src/metermap.cpp the same way as PlanBlocks()
+#  in include/MeterMap.h. The model replays the scheduler of src/modbus.cpp: due blocks are queued
+#  earliest deadline first, one request on the bus at a time, a block read is dropped at the end of
+#  its poll interval (overrun). A transaction takes the request frame, the response delay of the meter,
+#  the response frame and 3.5 characters of silence, until eModbus detects the end of the response.
+#  For more than 19200 baud the silence is fixed to 1750 us (Modbus over serial line, 2.5.1.1).
+#
+#  usage: mbplan.py [options] --meter TYPE:ADDR[-LAST][,latency=ms][,jitter=ms] ...
+#     --meter SDM630:1-8         meter type and address (range: several meters of one type)
+#        latency=ms              response delay of the meter (default: --latency)
+#        jitter=ms               random additional delay (default: --jitter)
+#     --baud N                   bus speed (default 9600)
+#     --format 8N1               data bits, parity, stop bits (default 8N1)
+#     --latency MS               default response delay (default 20)
+#     --jitter MS                default random additional delay (default 0)
+#     --overhead MS              gateway time from a response to the next request (default 0.5)
+#     --tick MS                  period of ModBusHandle() in loop() (default 1)
+#     --duration S               simulated time (default 600)
+#     --fit TYPE                 add meters of TYPE until the bus is over capacity
+#     --gateway HOST             model the meters of a gateway and compare with its counters (/api/metrics)
+#     --window S                 measurement window of --gateway (default 60)
+#     --capture FILE             compare the model with the round trip times of a capture (/api/capture)
+#     --plan                     print the read plans
+#
+#  examples: mbplan.py --baud 9600 --meter SDM630:1-4 --meter FINDER:10
+#            mbplan.py --meter SDM630:1 --fit SDM230
+#            mbplan.py --gateway hahismbgw01.local --capture modbus.pcap
+#
+#  MIT License, (c)2021 Team HAHIS
+#
+
+import argparse
+import heapq
+import json
+import os
+import random
+import re
+import sys
+import time
+import urllib.request
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+REGISTER_H = os.path.join(ROOT, 'include', 'ModbusRegister.h')
+METERMAP_H = os.path.join(ROOT, 'include', 'MeterMap.h')
+METERMAP_CPP = os.path.join(ROOT, 'src', 'metermap.cpp')
+
+FC = {'READ_HOLD_REGISTER': 0x03, 'READ_INPUT_REGISTER': 0x04}
+READ_REQ_BYTES = 8          # id, fc, addr, words, CRC
+READ_RSP_BYTES = 5          # id, fc, byte count, CRC + data
+QUEUE_POLL = 16             # MB_QUEUE_POLL
+RTT_BUCKETS = 12            # MBM_RTT_BUCKETS: <1ms, <2ms .. <1024ms, more
+
+
+def read_defines(path, pattern):
+    """ numeric #defines of a header: {name: value} """
+    values = {}
+    with open(path) as f:
+        for line in f:
+            m = re.match(r'#define\s+(' + pattern + r')\s+\(?\s*(0x[0-9a-fA-F]+|\d+)L?\s*\)?', line)
+            if m:
+                values[m.group(1)] = int(m.group(2), 0)
+    return values
+
+
+class Block:
+    """ one block read of a read plan """
+
+    def __init__(self, fc, start, words, poll):
+        self.fc = fc
+        self.start = start
+        self.words = words
+        self.poll = poll        # poll class, index into intervals
+        self.nregs = 1
+
+
+def plan_blocks(regs, max_words, max_gap):
+    """ merge register reads into block reads, see PlanBlocks() """
+    blocks = []
+    for fc, addr, words, poll in regs:
+        end = addr + words
+        if blocks:
+            b = blocks[-1]
+            if b.fc == fc and b.poll == poll and addr <= b.start + b.words + max_gap and end - b.start <= max_words:
+                b.words = max(b.words, end - b.start)
+                b.nregs += 1
+                continue
+        blocks.append(Block(fc, addr, words, poll))
+    return blocks
+
+
+def load_plans():
+    """ read plans of all meter types: {type: ([Block], [interval ms by poll class])} """
+    addrs = read_defines(REGISTER_H, r'\w+')
+    limits = read_defines(METERMAP_H, r'MB_\w+')
+    intervals = [limits['MB_POLL_FAST_MS'], limits['MB_POLL_NORMAL_MS'], limits['MB_POLL_SLOW_MS']]
+    polls = {'PC_FAST': 0, 'PC_NORMAL': 1, 'PC_SLOW': 2}
+
+    with open(METERMAP_CPP) as f:
+        src = f.read()
+    # register macros: name -> (function code, words)
+    macros = {}
+    for m in re.finditer(r'#define\s+(\w+)\(addr[^)]*\)\s*\{\s*(\w+),\s*addr,\s*(\d+),', src):
+        macros[m.group(1)] = (FC[m.group(2)], int(m.group(3)))
+    # register maps: name -> [(fc, addr, words, poll)]
+    maps = {}
+    for m in re.finditer(r'mb_regdesc_t\s+(\w+)\[\]\s*=\s*\{(.*?)\};', src, re.S):
+        regs = []
+        for r in re.finditer(r'(\w+)\((\w+),[^)]*?(PC_\w+)\)', m.group(2)):
+            fc, words = macros[r.group(1)]
+            regs.append((fc, addrs[r.group(2)], words, polls[r.group(3)]))
+        maps[m.group(1)] = regs
+    # max. gap of each map: PlanBlocks(map) or PlanBlocks(map, gap)
+    gaps = {}
+    for m in re.finditer(r'PlanBlocks\((\w+)(?:,\s*(\d+))?\)', src):
+        gaps[m.group(1)] = int(m.group(2)) if m.group(2) else limits['MB_MAX_BLOCK_GAP']
+    # meter types
+    plans = {}
+    for m in re.finditer(r'MAP_ENTRY\("(\w+)",\s*(\w+),', src):
+        plans[m.group(1).upper()] = plan_blocks(maps[m.group(2)], limits['MB_MAX_BLOCK_WORDS'], gaps[m.group(2)])
+    for m in re.finditer(r'MAP_EMPTY\("(\w+)",', src):
+        if m.group(1) != 'unknown':
+            plans[m.group(1).upper()] = []
+    return plans, intervals
+
+
+class Line:
+    """ timing of the serial line """
+
+    def __init__(self, baud, fmt):
+        m = re.fullmatch(r'([5-8])([NEO])([12])', fmt.upper())
+        if not m:
+            raise ValueError('format %s, expected e.g. 8N1' % fmt)
+        self.bits = 1 + int(m.group(1)) + (0 if m.group(2) == 'N' else 1) + int(m.group(3))
+        self.char_us = self.bits * 1e6 / baud
+        self.silence_us = 1750.0 if baud > 19200 else 3.5 * self.char_us
+        self.baud = baud
+        self.fmt = fmt.upper()
+
+    def frames_us(self, words):
+        """ request and response frame of a block read on the wire """
+        return (READ_REQ_BYTES + READ_RSP_BYTES + 2 * words) * self.char_us
+
+    def rtt_us(self, words, delay_us):
+        """ round trip time as the gateway measures it: until eModbus has detected the end of the response """
+        return self.frames_us(words) + delay_us + self.silence_us
+
+
+class Meter:
+    """ meter in the model with the scheduler state of ModBusMeter """
+
+    def __init__(self, mtype, addr, blocks, latency, jitter):
+        self.type = mtype
+        self.addr = addr
+        self.blocks = blocks
+        self.latency_us = latency * 1000.0
+        self.jitter_us = jitter * 1000.0
+        # a cycle is complete with the last block of the fastest poll class
+        self.cycle_block = 0
+        for i, b in enumerate(blocks):
+            if b.poll <= blocks[self.cycle_block].poll:
+                self.cycle_block = i
+        self.reset()
+
+    def reset(self):
+        self.due = [0.0] * len(self.blocks)
+        self.requests = 0
+        self.overruns = 0
+        self.rtt_sum = 0.0
+        self.cycles = []                                # completion times of cycles
+        self.last_start = [None] * len(self.blocks)     # request of last completed read
+        self.stale = [0.0] * len(self.blocks)           # max. age of the values of a block
+
+
+class Model:
+    """ discrete event model of the poll scheduler, times in us """
+
+    def __init__(self, line, meters, intervals, overhead, tick, seed=1):
+        self.line = line
+        self.meters = meters
+        self.intervals = [t * 1000.0 for t in intervals]
+        self.overhead_us = overhead * 1000.0
+        self.tick_us = tick * 1000.0
+        self.random = random.Random(seed)
+
+    def due_block(self, m, now):
+        """ due block with the earliest deadline, see GetDueBlock() """
+        best = None
+        for i, b in enumerate(m.blocks):
+            if now >= m.due[i]:
+                d = m.due[i] + self.intervals[b.poll]
+                if best is None or d < best[1]:
+                    best = (i, d)
+        return best
+
+    def fill(self, queue, now, seq):
+        """ queue due blocks earliest deadline first, see PollSchedule() and QueueBlock() """
+        while len(queue) < QUEUE_POLL:
+            best = None
+            for m in self.meters:
+                b = self.due_block(m, now)
+                if b and (best is None or b[1] < best[2]):
+                    best = (m, b[0], b[1])
+            if best is None:
+                break
+            m, i, _ = best
+            t = self.intervals[m.blocks[i].poll]
+            m.due[i] += t
+            if now >= m.due[i]:
+                m.overruns += 1
+                m.due[i] = now + t
+            heapq.heappush(queue, (m.due[i], next(seq), m, i))
+
+    def run(self, duration):
+        """ simulate duration [s], returns busy time on the wire and incl. response delays [us] """
+        for m in self.meters:
+            m.reset()
+        end = duration * 1e6
+        now = 0.0
+        queue = []
+        seq = iter(range(1 << 62))
+        wire = busy = 0.0
+        while now < end:
+            self.fill(queue, now, seq)
+            # drop block reads at the end of their poll interval
+            while queue and queue[0][0] <= now:
+                _, _, m, _ = heapq.heappop(queue)
+                m.overruns += 1
+            if not queue:
+                # idle until the next block is due, ModBusHandle() polls every tick
+                due = min((d for m in self.meters for d in m.due), default=end)
+                now = max(now + self.tick_us, (int(due / self.tick_us) + 1) * self.tick_us)
+                continue
+            _, _, m, i = heapq.heappop(queue)
+            b = m.blocks[i]
+            delay = m.latency_us + self.random.uniform(0, m.jitter_us)
+            rtt = self.line.rtt_us(b.words, delay)
+            start = now
+            now += rtt
+            m.requests += 1
+            m.rtt_sum += rtt
+            wire += self.line.frames_us(b.words)
+            busy += rtt
+            if m.last_start[i] is not None:
+                m.stale[i] = max(m.stale[i], now - m.last_start[i])
+            m.last_start[i] = start
+            if i == m.cycle_block:
+                m.cycles.append(now)
+            now += self.overhead_us
+        # values not updated until the end
+        for m in self.meters:
+            for i in range(len(m.blocks)):
+                m.stale[i] = max(m.stale[i], now - (m.last_start[i] or 0.0))
+        return wire, busy
+
+
+def parse_meters(specs, plans, latency, jitter):
+    meters = []
+    for spec in specs:
+        head, _, opts = spec.partition(',')
+        mtype, _, addr = head.partition(':')
+        mtype = mtype.upper()
+        if mtype not in plans:
+            raise ValueError('unknown meter type %s, known: %s' % (mtype, ', '.join(sorted(plans))))
+        first, _, last = addr.partition('-')
+        opt = {'latency': latency, 'jitter': jitter}
+        for o in filter(None, opts.split(',')):
+            k, _, v = o.partition('=')
+            opt[k] = float(v)
+        for a in range(int(first), int(last or first) + 1):
+            meters.append(Meter(mtype, a, plans[mtype], opt['latency'], opt['jitter']))
+    return meters
+
+
+def print_plans(plans, intervals):
+    names = ['fast', 'normal', 'slow']
+    for mtype, blocks in sorted(plans.items()):
+        print('%s:' % mtype)
+        for b in blocks:
+            print('  fc %02X  0x%04X..0x%04X  %3d words  %2d registers  %s (%d ms)' % (
+                b.fc, b.start, b.start + b.words - 1, b.words, b.nregs, names[b.poll], intervals[b.poll]))
+
+
+def report(model, duration, wire, busy):
+    line = model.line
+    names = ['fast', 'normal', 'slow']
+    print('bus: %d baud %s, %d bits per char, char %.3f ms, silence %.3f ms, %d meters, %d s simulated' % (
+        line.baud, line.fmt, line.bits, line.char_us / 1000, line.silence_us / 1000, len(model.meters), duration))
+    print('  type       addr  blocks   req/s   rtt ms   cycle avg ms   cycle max ms  stale fast/normal/slow ms   overruns')
+    overruns = 0
+    for m in model.meters:
+        cycles = [b - a for a, b in zip(m.cycles, m.cycles[1:])]
+        stale = []
+        for pc in range(3):
+            s = [m.stale[i] for i, b in enumerate(m.blocks) if b.poll == pc]
+            stale.append('%d' % (max(s) / 1000) if s else '-')
+        print('  %-8s %5d %7d %7.2f %8.1f %14s %14s  %-25s %9d' % (
+            m.type, m.addr, len(m.blocks), m.requests / duration, m.rtt_sum / max(m.requests, 1) / 1000,
+            '%.0f' % (sum(cycles) / len(cycles) / 1000) if cycles else '-',
+            '%.0f' % (max(cycles) / 1000) if cycles else '-', '/'.join(stale), m.overruns))
+        overruns += m.overruns
+    util = 100.0 * busy / (duration * 1e6)
+    print('utilization %.1f %% (frames on the wire %.1f %%), overruns %d' % (util, 100.0 * wire / (duration * 1e6), overruns))
+    # the same estimate as GetBusTime(), shown as "load" by /api/metrics
+    load = 0.0
+    for m in model.meters:
+        for b in m.blocks:
+            bits = (READ_REQ_BYTES + READ_RSP_BYTES + 2 * b.words) * 10 + 2 * 35
+            load += (bits * 1000.0 / line.baud + 20) * 1e6 / model.intervals[b.poll]
+    print('firmware estimate of bus load %d %%' % (load / 10))
+    return util, overruns
+
+
+def fits(model, duration):
+    wire, busy = model.run(duration)
+    return sum(m.overruns for m in model.meters) == 0 and busy < 0.9 * duration * 1e6
+
+
+def fit(args, model, plans):
+    """ add meters of one type until a block read misses its poll interval or utilization exceeds 90 % """
+    mtype = args.fit.upper()
+    addr = max([m.addr for m in model.meters], default=0)
+    n = 0
+    while n < 247:
+        model.meters.append(Meter(mtype, addr + n + 1, plans[mtype], args.latency, args.jitter))
+        if not fits(model, args.duration):
+            model.meters.pop()
+            break
+        n += 1
+    print('%d more %s meters fit (no overruns, utilization < 90 %%)' % (n, mtype))
+
+
+def fetch(host, path):
+    url = host if host.startswith('http') else 'http://' + host
+    with urllib.request.urlopen(url.rstrip('/') + path, timeout=10) as f:
+        return json.loads(f.read().decode())
+
+
+def bucket(ms):
+    """ rtt bucket of the gateway metrics """
+    k = 0
+    while k < RTT_BUCKETS - 1 and ms >= (1 << k):
+        k += 1
+    return k
+
+
+def bucket_text(k):
+    if k == 0:
+        return '<1 ms'
+    if k == RTT_BUCKETS - 1:
+        return '>=%d ms' % (1 << (k - 1))
+    return '%d..%d ms' % (1 << (k - 1), 1 << k)
+
+
+def validate_gateway(args, plans, intervals):
+    """ model the meters of a gateway with their measured response delay, compare with the counters of a window """
+    m0 = fetch(args.gateway, '/api/metrics')
+    print('measuring %d s ...' % args.window)
+    time.sleep(args.window)
+    m1 = fetch(args.gateway, '/api/metrics')
+    seconds = (m1['uptime'] - m0['uptime']) / 1000.0
+
+    line = Line(m1['bus'].get('baud', args.baud), args.format)
+    meters = []
+    for a, b in zip(m0['meters'], m1['meters']):
+        mtype = b.get('type', 'unknown').upper()
+        if mtype not in plans:
+            print('meter %d: type %s not modeled' % (b['addr'], mtype))
+            continue
+        meters.append(Meter(mtype, b['addr'], plans[mtype], b.get('delay', args.latency), args.jitter))
+    model = Model(line, meters, intervals, args.overhead, args.tick)
+    wire, busy = model.run(args.duration)
+    util, _ = report(model, args.duration, wire, busy)
+
+    print('\nmodel vs. gateway (%d s):' % seconds)
+    print('  addr   req/s model/gateway    rtt model / gateway median   overruns/min model/gateway')
+    byaddr = {m.addr: m for m in meters}
+    for a, b in zip(m0['meters'], m1['meters']):
+        m = byaddr.get(b['addr'])
+        if not m:
+            continue
+        req = (b['req'] - a['req']) / seconds
+        rtt = [y - x for x, y in zip(a['rtt'], b['rtt'])]
+        median = '-'
+        if sum(rtt):
+            acc = 0
+            for k, n in enumerate(rtt):
+                acc += n
+                if acc * 2 >= sum(rtt):
+                    median = bucket_text(k)
+                    break
+        mrtt = m.rtt_sum / max(m.requests, 1) / 1000
+        print('  %4d   %6.2f / %-6.2f       %6.1f ms (%s) / %-12s %8.2f / %.2f' % (
+            m.addr, m.requests / args.duration, req, mrtt, bucket_text(bucket(mrtt)), median,
+            m.overruns * 60.0 / args.duration, (b['overruns'] - a['overruns']) * 60.0 / seconds))
+    gw = (m1['bus']['busy'] - m0['bus']['busy']) / (seconds * 10.0)
+    print('  utilization model %.1f %% / gateway %.1f %%' % (util, gw))
+
+
+def validate_capture(path, model):
+    """ compare the round trip times of a capture with the frame times of the model """
+    sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+    from mbcapture import read_pcap, percentile, CR_REQUEST, CR_RESPONSE
+
+    line = model.line
+    pending = {}
+    devices = {}
+    for t, typ, _, frame in read_pcap(path):
+        if typ == CR_REQUEST and len(frame) >= 8 and frame[1] in FC.values():
+            pending[frame[0]] = (t, frame[1], (frame[4] << 8) | frame[5])
+        elif typ == CR_RESPONSE and frame[0] in pending and not frame[1] & 0x80:
+            start, fc, words = pending.pop(frame[0])
+            # response frame ends with CRC, the gateway timestamps after the silence
+            rtt = (t - start) * 1e6
+            devices.setdefault(frame[0], []).append((rtt, line.rtt_us(words, 0)))
+    byaddr = {m.addr: m for m in model.meters}
+    print('\ncapture %s: round trip time = frames + silence + response delay' % path)
+    print('  addr  reads   frames ms   measured avg ms   p99 ms   delay avg ms   model delay ms')
+    for addr in sorted(devices):
+        d = devices[addr]
+        rtt = [r for r, _ in d]
+        delay = [r - f for r, f in d]
+        m = byaddr.get(addr)
+        print('  %4d %6d %11.2f %17.2f %8.2f %14.2f %16s' % (
+            addr, len(d), sum(f for _, f in d) / len(d) / 1000, sum(rtt) / len(rtt) / 1000,
+            percentile(rtt, 99) / 1000, sum(delay) / len(delay) / 1000, '%.2f' % (m.latency_us / 1000) if m else '-'))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--meter', action='append', default=[], help='TYPE:ADDR[-LAST][,latency=ms][,jitter=ms]')
+    parser.add_argument('--baud', type=int, default=9600)
+    parser.add_argument('--format', default='8N1')
+    parser.add_argument('--latency', type=float, default=20.0, help='response delay of a meter [ms]')
+    parser.add_argument('--jitter', type=float, default=0.0, help='random additional delay [ms]')
+    parser.add_argument('--overhead', type=float, default=0.5, help='gateway time between response and next request [ms]')
+    parser.add_argument('--tick', type=float, default=1.0, help='period of ModBusHandle() [ms]')
+    parser.add_argument('--duration', type=int, default=600, help='simulated time [s]')
+    parser.add_argument('--fit', help='add meters of this type until the bus is over capacity')
+    parser.add_argument('--gateway', help='model the meters of a gateway and compare with its counters')
+    parser.add_argument('--window', type=int, default=60, help='measurement window of --gateway [s]')
+    parser.add_argument('--capture', help='compare with the round trip times of a capture')
+    parser.add_argument('--plan', action='store_true', help='print the read plans')
+    args = parser.parse_args()
+
+    plans, intervals = load_plans()
+    if args.plan:
+        print_plans(plans, intervals)
+    if args.gateway:
+        validate_gateway(args, plans, intervals)
+        return
+    try:
+        meters = parse_meters(args.meter, plans, args.latency, args.jitter)
+    except ValueError as e:
+        parser.error(str(e))
+    if not meters and not args.fit:
+        if not args.plan:
+            parser.error('no meters, use --meter TYPE:ADDR')
+        return
+    model = Model(Line(args.baud, args.format), meters, intervals, args.overhead, args.tick)
+    if args.fit:
+        fit(args, model, plans)
+    wire, busy = model.run(args.duration)
+    report(model, args.duration, wire, busy)
+    if args.capture:
+        validate_capture(args.capture, model)
+
+
+if __name__ == '__main__':
+    main()
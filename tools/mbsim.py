@@ -0,0 +1,397 @@
+#!/usr/bin/env python3
+""" Virtual Modbus RTU meters on a pseudo-terminal """
+#
+#  mbsim.py - emulates Modbus RTU meters on a pty for tests without meter hardware
+#
+#  The registers of each meter type are taken from include/ModbusRegister.h:
+#  SDM and DDM meters serve IEEE floats as input registers (FC04), the SDM table columns
+#  decide which registers a model provides. The Finder 7E.23 serves fixed point holding registers (FC03).
+#  Values change slowly over time, energy counters integrate the power.
+#
+#  usage: mbsim.py [options] --meter TYPE:ADDR[,option=value...] ...
+#     --meter SDM630:1,latency=30,crc=0.01   meter type and address with meter options:
+#        latency=ms     response delay (default: --latency)
+#        jitter=ms      random additional delay (default: --jitter)
+#        crc=p          probability of a response with corrupted CRC
+#        silence=p      probability of no response
+#        exception=p    probability of an exception response (04: server device failure)
+#        down=s:d       no responses from second s for d seconds after start
+#     --link PATH       symlink to the pty, e.g. /tmp/ttyMB
+#     --baud N          bus speed for the time of frames on the wire (default 9600)
+#     --latency MS      default response delay (default 20)
+#     --jitter MS       default random additional delay (default 5)
+#     --stats S         print statistics every S seconds (default 10)
+#     -v                print all frames
+#
+#  example: mbsim.py --link /tmp/ttyMB --meter SDM630:1 --meter SDM230:2,silence=0.05 --meter FINDER:5
+#
+#  MIT License, (c)2021 Team HAHIS
+#
+
+import argparse
+import math
+import os
+import random
+import re
+import select
+import struct
+import sys
+import time
+import tty
+
+REGISTER_H = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'include', 'ModbusRegister.h')
+SDM_MODELS = ['SDM630', 'SDM230', 'SDM220', 'SDM120CT', 'SDM120', 'SDM72D']
+TYPES = {'SDM630': 'SDM630', 'SDM230': 'SDM230', 'SDM220': 'SDM220', 'SDM120': 'SDM120', 'SDM120CT': 'SDM120CT',
+         'SDM72D': 'SDM72D', 'DDM': 'DDM', 'FINDER': 'FINDER'}
+
+READ_HOLD_REGISTER = 0x03
+READ_INPUT_REGISTER = 0x04
+WRITE_HOLD_REGISTER = 0x06
+WRITE_MULT_REGISTERS = 0x10
+
+ILLEGAL_FUNCTION = 0x01
+ILLEGAL_DATA_ADDRESS = 0x02
+ILLEGAL_DATA_VALUE = 0x03
+SERVER_DEVICE_FAILURE = 0x04
+
+MAX_READ_WORDS = 125
+FRAME_GAP = 0.05        # bytes after this pause start a new frame [s]
+
+
+def crc16(data):
+    crc = 0xffff
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xa001 if crc & 1 else crc >> 1
+    return crc
+
+
+def with_crc(frame):
+    return frame + struct.pack('<H', crc16(frame))
+
+
+class Register:
+    """ one value of a register map """
+
+    def __init__(self, name, addr, words, fmt, scale):
+        self.name = name
+        self.addr = addr
+        self.words = words
+        self.fmt = fmt          # 'f': float, 'H': u16, 'I': u32
+        self.scale = scale
+
+    def encode(self, value):
+        if self.fmt == 'f':
+            return struct.pack('>f', value)
+        raw = max(0, int(round(value / self.scale)))
+        if self.fmt == 'H':
+            return struct.pack('>H', min(raw, 0xffff))
+        return struct.pack('>I', min(raw, 0xffffffff))
+
+
+def parse_register_h(path):
+    """ register maps by meter type: {type: (function code, [Register])} """
+    maps = {t: [] for t in TYPES.values()}
+    pattern = re.compile(r'#define\s+(SDM|DDM|FINDER)_(\w+)\s+(\S+)\s*//(.*)')
+    with open(path) as f:
+        for line in f:
+            m = pattern.match(line)
+            if not m:
+                continue
+            family, name, addr, comment = m.groups()
+            if not re.fullmatch(r'[0-9a-fA-FxX()+\-]+', addr):
+                continue
+            addr = eval(addr)
+            columns = [c.strip() for c in comment.split('|')]
+            if family == 'SDM':
+                for model, col in zip(SDM_MODELS, columns[1:]):
+                    if col == '1':
+                        maps[model].append(Register(name, addr, 2, 'f', 1.0))
+            elif family == 'DDM':
+                maps['DDM'].append(Register(name, addr, 2, 'f', 1.0))
+            else:
+                words = int(columns[1]) if len(columns) > 1 and columns[1].isdigit() else 1
+                unit = columns[0]
+                scale = 1.0
+                s = re.search(r'\(\*([0-9.]+)\)', unit)
+                if s:
+                    scale = float(s.group(1))
+                elif '10e-2' in unit:
+                    scale = 0.01
+                maps['FINDER'].append(Register(name, addr, words, 'H' if words == 1 else 'I', scale))
+    fc = {t: READ_INPUT_REGISTER for t in maps}
+    fc['FINDER'] = READ_HOLD_REGISTER
+    return {t: (fc[t], sorted(regs, key=lambda r: r.addr)) for t, regs in maps.items()}
+
+
+class Meter:
+    """ virtual meter: electrical values of a slowly changing load """
+
+    def __init__(self, mtype, addr, fc, regs, opts):
+        self.type = mtype
+        self.addr = addr
+        self.fc = fc
+        self.regs = regs
+        self.opts = opts
+        self.holding = {}       # written holding registers
+        self.start = time.time()
+        self.last = self.start
+        self.energy_in = random.uniform(100.0, 10000.0)
+        self.energy_out = random.uniform(0.0, 100.0)
+        self.seed = random.uniform(0, 2 * math.pi)
+        self.stats = {'requests': 0, 'responses': 0, 'crc': 0, 'silence': 0, 'exception': 0, 'down': 0}
+
+    def phase(self, t, n):
+        """ voltage, current, power factor of phase n at time t """
+        v = 230.0 + 3.0 * math.sin(t / 37.0 + self.seed + n)
+        i = 5.0 + 4.0 * math.sin(t / 23.0 + self.seed + 2.1 * n) + random.uniform(-0.05, 0.05)
+        pf = 0.92 + 0.05 * math.sin(t / 51.0 + n)
+        return v, max(i, 0.0), pf
+
+    def update(self):
+        """ integrate energy counters [kWh] """
+        now = time.time()
+        p = sum(self.power(now, n) for n in range(self.phases()))
+        dt = (now - self.last) / 3600.0
+        if p >= 0:
+            self.energy_in += p * dt / 1000.0
+        else:
+            self.energy_out -= p * dt / 1000.0
+        self.last = now
+
+    def phases(self):
+        return 3 if self.type in ('SDM630', 'SDM72D') else 1
+
+    def power(self, t, n):
+        v, i, pf = self.phase(t, n)
+        return v * i * pf
+
+    def value(self, name, t):
+        m = re.search(r'(?:PHASE_|L)([123])_', name)
+        n = int(m.group(1)) - 1 if m else 0
+        nph = self.phases()
+        v, i, pf = self.phase(t, n)
+        if 'THD' in name:
+            return 2.5
+        if 'FIRMWARE' in name:
+            return 11
+        if 'ENERGY' in name:
+            if 'EXPORT' in name:
+                return self.energy_out
+            if 'REACTIVE' in name:
+                return self.energy_in * 0.3
+            return self.energy_in
+        if 'FREQUENCY' in name:
+            return 50.0 + 0.03 * math.sin(t / 11.0)
+        if 'POWER_FACTOR' in name or 'COSPHI' in name:
+            return pf
+        if 'ANGLE' in name:
+            return math.degrees(math.acos(pf))
+        if 'LINE_TO_LINE' in name or re.search(r'LINE_\d_TO_LINE', name):
+            return v * math.sqrt(3)
+        if 'VOLT' in name:
+            return v
+        if 'CURRENT' in name:
+            return sum(self.phase(t, k)[1] for k in range(nph)) if 'SUM' in name else i
+        if 'APPARENT' in name or '_VA_' in name:
+            return v * i
+        if 'REACTIVE' in name:
+            q = v * i * math.sin(math.acos(pf))
+            return q / 1000.0 if self.type == 'FINDER' else q
+        if 'EXPORT' in name or 'REVERSE' in name:
+            return 0.0
+        if 'POWER' in name:
+            if 'TOTAL' in name or 'SYSTEM' in name or name.startswith('IMPORT'):
+                return sum(self.power(t, k) for k in range(nph))
+            p = v * i * pf
+            return p / 1000.0 if self.type == 'FINDER' else p
+        return 0.0
+
+    def read(self, fc, start, words):
+        """ register values, exception code if not provided """
+        if fc == READ_HOLD_REGISTER and self.fc != READ_HOLD_REGISTER:
+            if all(start + k in self.holding for k in range(words)):
+                return b''.join(struct.pack('>H', self.holding[start + k]) for k in range(words))
+            return ILLEGAL_DATA_ADDRESS
+        if fc != self.fc:
+            return ILLEGAL_FUNCTION
+        if words < 1 or words > MAX_READ_WORDS:
+            return ILLEGAL_DATA_VALUE
+        self.update()
+        t = time.time()
+        data = bytearray(2 * words)
+        found = False
+        for r in self.regs:
+            if r.addr >= start and r.addr + r.words <= start + words:
+                off = 2 * (r.addr - start)
+                data[off:off + 2 * r.words] = r.encode(self.value(r.name, t))
+                found = True
+        for a, v in self.holding.items():
+            if start <= a < start + words:
+                data[2 * (a - start):2 * (a - start) + 2] = struct.pack('>H', v)
+                found = True
+        return bytes(data) if found else ILLEGAL_DATA_ADDRESS
+
+    def write(self, start, values):
+        for k, v in enumerate(values):
+            self.holding[start + k] = v
+
+    def fault(self):
+        """ fault injected for next response: None, 'crc', 'silence', 'exception', 'down' """
+        elapsed = time.time() - self.start
+        down = self.opts.get('down')
+        if down and down[0] <= elapsed < down[0] + down[1]:
+            return 'down'
+        for f in ('silence', 'crc', 'exception'):
+            if random.random() < self.opts.get(f, 0.0):
+                return f
+        return None
+
+
+def handle(meter, frame):
+    """ response frame incl. CRC, None: no response """
+    fc = frame[1]
+    meter.stats['requests'] += 1
+    fault = meter.fault()
+    if fault in ('down', 'silence'):
+        meter.stats[fault] += 1
+        return None
+
+    if fault == 'exception':
+        result = SERVER_DEVICE_FAILURE
+    elif fc in (READ_HOLD_REGISTER, READ_INPUT_REGISTER):
+        start, words = struct.unpack('>HH', frame[2:6])
+        result = meter.read(fc, start, words)
+    elif fc == WRITE_HOLD_REGISTER:
+        start, value = struct.unpack('>HH', frame[2:6])
+        meter.write(start, [value])
+        result = frame[2:6]
+    elif fc == WRITE_MULT_REGISTERS:
+        start, words, nbytes = struct.unpack('>HHB', frame[2:7])
+        meter.write(start, list(struct.unpack('>%dH' % words, frame[7:7 + nbytes])))
+        result = frame[2:6]
+    else:
+        result = ILLEGAL_FUNCTION
+
+    if isinstance(result, int):
+        meter.stats['exception'] += 1
+        response = with_crc(bytes([meter.addr, fc | 0x80, result]))
+    elif fc in (WRITE_HOLD_REGISTER, WRITE_MULT_REGISTERS):
+        response = with_crc(bytes([meter.addr, fc]) + result)
+    else:
+        response = with_crc(bytes([meter.addr, fc, len(result)]) + result)
+    meter.stats['responses'] += 1
+
+    if fault == 'crc':
+        meter.stats['crc'] += 1
+        response = response[:-1] + bytes([response[-1] ^ 0x5a])
+    return response
+
+
+def frame_length(buf):
+    """ length of the request frame at the start of buf, 0: incomplete """
+    if len(buf) < 8:
+        return 0
+    if buf[1] == WRITE_MULT_REGISTERS:
+        return 9 + buf[6] if len(buf) >= 9 + buf[6] else 0
+    return 8
+
+
+def parse_meter(spec, defaults, maps):
+    mtype, _, rest = spec.partition(':')
+    addr, _, options = rest.partition(',')
+    mtype = TYPES.get(mtype.upper())
+    if mtype is None:
+        raise ValueError('unknown meter type in %s' % spec)
+    opts = dict(defaults)
+    for o in filter(None, options.split(',')):
+        key, _, value = o.partition('=')
+        if key == 'down':
+            s, d = value.split(':')
+            opts['down'] = (float(s), float(d))
+        else:
+            opts[key] = float(value)
+    fc, regs = maps[mtype]
+    return Meter(mtype, int(addr), fc, regs, opts)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Virtual Modbus RTU meters on a pseudo-terminal')
+    parser.add_argument('--meter', action='append', required=True, help='TYPE:ADDR[,option=value...]')
+    parser.add_argument('--link', help='symlink to the pty')
+    parser.add_argument('--baud', type=int, default=9600)
+    parser.add_argument('--latency', type=float, default=20.0)
+    parser.add_argument('--jitter', type=float, default=5.0)
+    parser.add_argument('--stats', type=float, default=10.0)
+    parser.add_argument('-v', action='store_true', dest='verbose')
+    args = parser.parse_args()
+
+    maps = parse_register_h(REGISTER_H)
+    defaults = {'latency': args.latency, 'jitter': args.jitter}
+    meters = {}
+    for spec in args.meter:
+        m = parse_meter(spec, defaults, maps)
+        meters[m.addr] = m
+        print('meter %s at %d: %d registers' % (m.type, m.addr, len(m.regs)), file=sys.stderr)
+
+    master, slave = os.openpty()
+    tty.setraw(master)
+    tty.setraw(slave)
+    path = os.ttyname(slave)
+    if args.link:
+        if os.path.islink(args.link):
+            os.unlink(args.link)
+        os.symlink(path, args.link)
+        path = args.link
+    print('serving on %s' % path, file=sys.stderr)
+
+    char_time = 10.0 / args.baud
+    buf = b''
+    last_rx = time.time()
+    next_stats = time.time() + args.stats
+    while True:
+        ready, _, _ = select.select([master], [], [], 0.1)
+        now = time.time()
+        if now >= next_stats:
+            for m in meters.values():
+                print('%3d %-8s %s' % (m.addr, m.type, ' '.join('%s %d' % s for s in m.stats.items())), file=sys.stderr)
+            next_stats = now + args.stats
+        if not ready:
+            continue
+        data = os.read(master, 512)
+        if now - last_rx > FRAME_GAP:
+            buf = b''
+        last_rx = now
+        buf += data
+
+        while True:
+            n = frame_length(buf)
+            if n == 0:
+                break
+            frame, rest = buf[:n], buf[n:]
+            if crc16(frame) != 0:
+                buf = buf[1:]       # resync
+                continue
+            buf = rest
+            if args.verbose:
+                print('> %s' % frame.hex(' '), file=sys.stderr)
+            meter = meters.get(frame[0])
+            if meter is None:
+                continue
+            response = handle(meter, frame)
+            if response is None:
+                continue
+            delay = meter.opts['latency'] + random.uniform(0, meter.opts['jitter'])
+            time.sleep(len(frame) * char_time + delay / 1000.0)
+            os.write(master, response)
+            time.sleep(len(response) * char_time)
+            if args.verbose:
+                print('< %s' % response.hex(' '), file=sys.stderr)
+
+
+if __name__ == '__main__':
+    try:
+        main()
+    except KeyboardInterrupt:
+        pass